@@ -0,0 +1,214 @@
+#include "devices/block-trace.h"
+#include <debug.h>
+#include <round.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Block request tracing.
+
+   When enabled with block_trace_init(), every request submitted
+   to a block device is recorded in a fixed-size ring buffer, so
+   that the most recent requests survive however long the kernel
+   runs.  At power off, block_trace_dump() writes the trace as
+   text, either to the console or to the scratch device, where
+   utils/block-trace can turn it into a heatmap or replay it
+   against a disk image.
+
+   The dump has one line per item, each starting with "btrace":
+
+     btrace begin RECORDS DROPPED
+     btrace device NAME SIZE PARENT START
+     btrace io TICK TID DEVICE R|W SECTOR CNT
+     btrace end
+
+   There is a "device" line for each block device, giving its
+   size in sectors and, for a partition, the device it is part of
+   and the sector there at which it starts ("-" and 0 otherwise).
+   The "io" lines follow in the order the requests were
+   submitted.  On the scratch device, the text ends at the first
+   null byte. */
+
+/* One traced request. */
+struct trace_record
+  {
+    int64_t tick;               /* Timer tick at submission. */
+    struct block *block;        /* Device submitted to. */
+    block_sector_t sector;      /* First sector. */
+    tid_t tid;                  /* Submitting thread. */
+    block_sector_t cnt;         /* Number of sectors. */
+    bool write;                 /* Write or read? */
+  };
+
+bool block_trace_scratch;
+
+static struct trace_record *records;    /* Ring buffer, or null. */
+static size_t record_cnt;               /* Capacity of ring buffer. */
+static size_t next_record;              /* Index of next slot to fill. */
+static uint64_t total_records;          /* Number ever recorded. */
+
+/* Starts recording block requests in a ring buffer that holds
+   the most recent RECORDS of them, which must not be more than
+   BLOCK_TRACE_MAX. */
+void
+block_trace_init (size_t records_)
+{
+  size_t pages = DIV_ROUND_UP (records_ * sizeof *records, PGSIZE);
+
+  ASSERT (records == NULL);
+  ASSERT (records_ <= BLOCK_TRACE_MAX);
+  if (records_ == 0)
+    return;
+
+  records = palloc_get_multiple (0, pages);
+  if (records == NULL)
+    PANIC ("can't allocate %zu pages for block trace", pages);
+  record_cnt = pages * PGSIZE / sizeof *records;
+  next_record = 0;
+  total_records = 0;
+  printf ("block trace: recording last %zu requests\n", record_cnt);
+}
+
+/* Records a request for CNT sectors starting at SECTOR on BLOCK,
+   if tracing is enabled.  May be called from an interrupt
+   handler, in which case the thread that was interrupted is
+   recorded as the requester. */
+void
+block_trace_record (struct block *block, block_sector_t sector,
+                    size_t cnt, bool write)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (records != NULL)
+    {
+      struct trace_record *r = &records[next_record];
+      next_record = (next_record + 1) % record_cnt;
+      total_records++;
+
+      r->tick = timer_ticks ();
+      r->block = block;
+      r->sector = sector;
+      r->tid = thread_current ()->tid;
+      r->cnt = cnt;
+      r->write = write;
+    }
+  intr_set_level (old_level);
+}
+
+/* Destination of a trace dump. */
+struct dump
+  {
+    struct block *block;        /* Device to write, or null for console. */
+    block_sector_t sector;      /* Next sector of BLOCK to write. */
+    size_t used;                /* Bytes of BUFFER in use. */
+    bool full;                  /* Ran out of room on BLOCK? */
+    char buffer[BLOCK_SECTOR_SIZE];
+  };
+
+/* Writes out D's buffer, padded with null bytes, as the next
+   sector of D's device. */
+static void
+flush_dump (struct dump *d)
+{
+  if (d->sector >= block_size (d->block))
+    {
+      d->full = true;
+      return;
+    }
+  memset (d->buffer + d->used, 0, sizeof d->buffer - d->used);
+  block_write (d->block, d->sector++, d->buffer);
+  d->used = 0;
+}
+
+/* Formats a line according to FORMAT and appends it to D. */
+static void PRINTF_FORMAT (2, 3)
+emit (struct dump *d, const char *format, ...)
+{
+  char line[128];
+  const char *p;
+  va_list args;
+
+  va_start (args, format);
+  vsnprintf (line, sizeof line, format, args);
+  va_end (args);
+
+  if (d->block == NULL)
+    {
+      printf ("%s", line);
+      return;
+    }
+
+  for (p = line; *p != '\0' && !d->full; p++)
+    {
+      d->buffer[d->used++] = *p;
+      if (d->used == sizeof d->buffer)
+        flush_dump (d);
+    }
+}
+
+/* Stops tracing and writes out the trace, to the scratch device
+   if block_trace_scratch is true and there is one, and otherwise
+   to the console. */
+void
+block_trace_dump (void)
+{
+  static struct dump d;
+  struct trace_record *ring;
+  enum intr_level old_level;
+  uint64_t dropped;
+  size_t cnt, i;
+  struct block *block;
+
+  /* Stop tracing, so that writing the dump does not add to it. */
+  old_level = intr_disable ();
+  ring = records;
+  records = NULL;
+  intr_set_level (old_level);
+  if (ring == NULL)
+    return;
+  cnt = total_records < record_cnt ? total_records : record_cnt;
+  dropped = total_records - cnt;
+
+  d.block = block_trace_scratch ? block_get_role (BLOCK_SCRATCH) : NULL;
+  d.sector = 0;
+  d.used = 0;
+  d.full = false;
+  if (d.block != NULL)
+    printf ("block trace: writing %zu requests to %s\n",
+            cnt, block_name (d.block));
+
+  emit (&d, "btrace begin %zu %"PRIu64"\n", cnt, dropped);
+  for (block = block_first (); block != NULL; block = block_next (block))
+    {
+      block_sector_t start;
+      struct block *parent = block_parent (block, &start);
+      emit (&d, "btrace device %s %"PRDSNu" %s %"PRDSNu"\n",
+            block_name (block), block_size (block),
+            parent != NULL ? block_name (parent) : "-", start);
+    }
+  for (i = 0; i < cnt; i++)
+    {
+      const struct trace_record *r
+        = &ring[(next_record + record_cnt - cnt + i) % record_cnt];
+      emit (&d, "btrace io %"PRId64" %d %s %c %"PRDSNu" %"PRDSNu"\n",
+            r->tick, r->tid, block_name (r->block), r->write ? 'W' : 'R',
+            r->sector, r->cnt);
+    }
+  emit (&d, "btrace end\n");
+
+  if (d.block != NULL)
+    {
+      /* Write the last partial sector, or a sector of null
+         bytes if there is none, to mark the end of the text. */
+      flush_dump (&d);
+      if (d.full)
+        printf ("block trace: %s is too small, trace truncated\n",
+                block_name (d.block));
+    }
+}
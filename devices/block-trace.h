@@ -0,0 +1,20 @@
+#ifndef DEVICES_BLOCK_TRACE_H
+#define DEVICES_BLOCK_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Most block requests the trace can keep. */
+#define BLOCK_TRACE_MAX 16384
+
+/* Dump the trace to the scratch device instead of the console?
+   Controlled by kernel command-line option "-trace-scratch". */
+extern bool block_trace_scratch;
+
+void block_trace_init (size_t records);
+void block_trace_record (struct block *, block_sector_t, size_t cnt,
+                         bool write);
+void block_trace_dump (void);
+
+#endif /* devices/block-trace.h */
@@ -1,9 +1,15 @@
 #include "devices/block.h"
+#include <block-stats.h>
+#include <inttypes.h>
 #include <list.h>
 #include <string.h>
 #include <stdio.h>
+#include "devices/block-trace.h"
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A block device. */
 struct block
@@ -17,10 +23,47 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct block_stats stats;           /* Statistics. */
+    block_sector_t next_sector;         /* Sector after last request. */
+    unsigned depth;                     /* Requests outstanding. */
+
+    struct block *parent;               /* Device this is a partition of. */
+    block_sector_t start;               /* First sector within PARENT. */
+
+    struct block_queue *queue;          /* Request queue, if any. */
+  };
+
+/* The request queue of a device whose driver transfers data
+   asynchronously.  The queue starts one transfer at a time, when
+   a request arrives at an idle device and whenever a transfer
+   completes, choosing the next request in C-LOOK order: it
+   sweeps upward from the sector after the last transfer, then
+   jumps back to the lowest pending sector.  A request that has
+   waited past its deadline goes first regardless, so that a
+   stream of requests just ahead of the head cannot starve one
+   behind it.  Requests for adjacent sectors in the same
+   direction are merged into one transfer.
+
+   Transfers complete in interrupt handlers, so interrupts must be
+   off while touching a queue. */
+struct block_queue
+  {
+    struct list requests;               /* Pending requests, by sector. */
+    struct list batch;                  /* Requests being transferred. */
+    size_t batch_cnt;                   /* Sectors in BATCH, 0 if idle. */
+    block_sector_t head;                /* Sector after the last transfer. */
+    uint8_t *merge_buffer;              /* MERGE_MAX sectors, or null. */
   };
 
+/* Ticks a request may wait before it is carried out ahead of the
+   elevator's order.  Reads usually have a thread waiting on
+   them, so they get the shorter deadline. */
+#define READ_DEADLINE (TIMER_FREQ / 2)
+#define WRITE_DEADLINE (5 * TIMER_FREQ)
+
+/* Most sectors that requests can be merged into. */
+#define MERGE_MAX 32
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -99,20 +142,69 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/* Verifies that SECTOR is a valid offset within BLOCK.
-   Panics if not. */
+/* Verifies that the CNT sectors starting at SECTOR all lie
+   within BLOCK.  Panics if not. */
 static void
-check_sector (struct block *block, block_sector_t sector)
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
 {
-  if (sector >= block->size)
+  if (sector >= block->size || cnt > block->size - sector)
     {
       /* We do not use ASSERT because we want to panic here
          regardless of whether NDEBUG is defined. */
-      PANIC ("Access past end of device %s (sector=%"PRDSNu", "
-             "size=%"PRDSNu")\n", block_name (block), sector, block->size);
+      PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+             "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+             block->size);
     }
 }
 
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER by calling BLOCK's synchronous driver operations. */
+static void
+transfer (struct block *block, block_sector_t sector, void *buffer,
+          size_t cnt, bool write)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *p = buffer;
+  size_t i;
+
+  if (write)
+    {
+      if (cnt > 1 && ops->write_multiple != NULL)
+        ops->write_multiple (block->aux, sector, p, cnt);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->write (block->aux, sector + i, p + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (cnt > 1 && ops->read_multiple != NULL)
+        ops->read_multiple (block->aux, sector, p, cnt);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->read (block->aux, sector + i, p + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER and waits for the transfer to complete. */
+static void
+transfer_sync (struct block *block, block_sector_t sector, void *buffer,
+               size_t cnt, bool write)
+{
+  struct block_request r;
+  struct block_request *rp = &r;
+
+  if (cnt == 0)
+    return;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.done = NULL;
+  block_submit (block, &r);
+  block_wait_any (&rp, 1);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +212,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer_sync (block, sector, buffer, 1, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +223,348 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer_sync (block, sector, (void *) buffer, 1, true);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  A driver that supports it transfers all of them with
+   as few commands as it can; otherwise this is equivalent to
+   calling block_read() for each sector in turn. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, size_t cnt)
+{
+  transfer_sync (block, sector, buffer, cnt, false);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  See block_read_multiple() for details. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, size_t cnt)
+{
+  transfer_sync (block, sector, (void *) buffer, cnt, true);
+}
+
+/* Returns the CPU's time-stamp counter, which counts clock
+   cycles. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Returns the latency histogram bucket for CYCLES. */
+static int
+latency_bucket (uint64_t cycles)
+{
+  int bucket = 0;
+
+  while (cycles > 1 && bucket < BLOCK_LATENCY_BUCKETS - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
+
+/* Records the submission of R, which starts at SECTOR on BLOCK,
+   in BLOCK's statistics.  Interrupts must be off. */
+static void
+account_submit (struct block *block, block_sector_t sector,
+                const struct block_request *r)
+{
+  struct block_stats *s = &block->stats;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (r->write)
+    {
+      s->write_reqs++;
+      s->write_cnt += r->cnt;
+    }
+  else
+    {
+      s->read_reqs++;
+      s->read_cnt += r->cnt;
+    }
+  if (sector == block->next_sector)
+    s->seq_reqs++;
+  block->next_sector = sector + r->cnt;
+  if (++block->depth > s->max_depth)
+    s->max_depth = block->depth;
+}
+
+/* Marks R complete, records its latency on the device it was
+   submitted to and each device that one is a partition of, and
+   notifies whoever is waiting for it. */
+static void
+finish_request (struct block_request *r)
+{
+  int bucket = latency_bucket (rdtsc () - r->start_time);
+  enum intr_level old_level;
+  struct block *b;
+
+  old_level = intr_disable ();
+  for (b = r->block; b != NULL; b = b->parent)
+    {
+      if (r->write)
+        b->stats.write_latency[bucket]++;
+      else
+        b->stats.read_latency[bucket]++;
+      b->depth--;
+    }
+  r->completed = true;
+  if (r->waiter != NULL)
+    sema_up (r->waiter);
+  intr_set_level (old_level);
+
+  if (r->done != NULL)
+    r->done (r);
+}
+
+/* Orders requests by ascending first sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->dev_sector < b->dev_sector;
+}
+
+/* Chooses the request that Q should carry out next: the one that
+   has been overdue longest, if any, or else the first at or past
+   the head in C-LOOK order.  Q must not be empty. */
+static struct block_request *
+next_request (struct block_queue *q)
+{
+  int64_t now = timer_ticks ();
+  struct block_request *overdue = NULL;
+  struct block_request *ahead = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->deadline <= now
+          && (overdue == NULL || r->deadline < overdue->deadline))
+        overdue = r;
+      if (ahead == NULL && r->dev_sector >= q->head)
+        ahead = r;
+    }
+
+  if (overdue != NULL)
+    return overdue;
+  else if (ahead != NULL)
+    return ahead;
+  else
+    return list_entry (list_front (&q->requests), struct block_request, elem);
+}
+
+/* Moves the next request in Q, along with any requests that
+   continue it without a gap in the same direction, to Q's batch
+   in sector order.  Returns the number of sectors in the batch.
+   Q must not be empty. */
+static size_t
+take_batch (struct block_queue *q)
+{
+  struct block_request *first = next_request (q);
+  struct list_elem *e = list_remove (&first->elem);
+  size_t cnt = first->cnt;
+
+  list_push_back (&q->batch, &first->elem);
+  while (q->merge_buffer != NULL && e != list_end (&q->requests))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->write != first->write
+          || r->dev_sector != first->dev_sector + cnt
+          || cnt + r->cnt > MERGE_MAX)
+        break;
+      e = list_remove (e);
+      list_push_back (&q->batch, &r->elem);
+      cnt += r->cnt;
+    }
+  q->head = first->dev_sector + cnt;
+  return cnt;
+}
+
+/* Copies data between the merge buffer of Q and the buffers of
+   the requests in Q's batch: into the merge buffer if TO_MERGE
+   is true, out of it otherwise. */
+static void
+copy_batch (struct block_queue *q, bool to_merge)
+{
+  uint8_t *p = q->merge_buffer;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->batch); e != list_end (&q->batch);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      size_t size = r->cnt * BLOCK_SECTOR_SIZE;
+
+      if (to_merge)
+        memcpy (p, r->buffer, size);
+      else
+        memcpy (r->buffer, p, size);
+      p += size;
+    }
+}
+
+/* Starts the next transfer on BLOCK, if BLOCK is idle and has
+   requests waiting.  Interrupts must be off. */
+static void
+dispatch (struct block *block)
+{
+  struct block_queue *q = block->queue;
+  struct block_request *first;
+  void *buffer;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (q->batch_cnt != 0 || list_empty (&q->requests))
+    return;
+  q->batch_cnt = take_batch (q);
+  first = list_entry (list_front (&q->batch), struct block_request, elem);
+
+  buffer = first->buffer;
+  if (list_front (&q->batch) != list_back (&q->batch))
+    {
+      buffer = q->merge_buffer;
+      if (first->write)
+        copy_batch (q, true);
+    }
+  block->ops->start (block->aux, first->dev_sector, buffer, q->batch_cnt,
+                     first->write);
+}
+
+/* Starts request R on BLOCK.  See the comment on struct
+   block_request in block.h for details. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  enum intr_level old_level;
+
+  ASSERT (r->cnt > 0);
+
+  block_trace_record (block, r->sector, r->cnt, r->write);
+  r->block = block;
+  r->completed = false;
+  r->waiter = NULL;
+  r->start_time = rdtsc ();
+
+  /* Account for the request on BLOCK and on each device it is a
+     partition of, down to the device that does the work. */
+  r->dev_sector = r->sector;
+  old_level = intr_disable ();
+  for (;;)
+    {
+      check_sectors (block, r->dev_sector, r->cnt);
+      ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+      account_submit (block, r->dev_sector, r);
+
+      if (block->parent == NULL)
+        break;
+      r->dev_sector += block->start;
+      block = block->parent;
+    }
+
+  if (block->queue == NULL)
+    {
+      intr_set_level (old_level);
+      transfer (block, r->dev_sector, r->buffer, r->cnt, r->write);
+      finish_request (r);
+      return;
+    }
+
+  r->deadline = timer_ticks () + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+  list_insert_ordered (&block->queue->requests, &r->elem, request_less, NULL);
+  dispatch (block);
+  intr_set_level (old_level);
+}
+
+/* Returns true if request R, which must have been submitted, has
+   completed. */
+bool
+block_poll (const struct block_request *r)
+{
+  return r->completed;
+}
+
+/* Returns the first request in REQS, an array of CNT submitted
+   requests, that has completed, waiting until one does if
+   necessary.  A request stays complete, so a caller that waits
+   repeatedly on the same array should remove each request that
+   is returned.  Requests in REQS must not be freed by their DONE
+   functions. */
+struct block_request *
+block_wait_any (struct block_request *reqs[], size_t cnt)
+{
+  struct block_request *r = NULL;
+  struct semaphore done;
+  enum intr_level old_level;
+  size_t i;
+
+  ASSERT (cnt > 0);
+
+  sema_init (&done, 0);
+  old_level = intr_disable ();
+  for (;;)
+    {
+      for (i = 0; i < cnt && r == NULL; i++)
+        if (reqs[i]->completed)
+          r = reqs[i];
+      if (r != NULL)
+        break;
+
+      for (i = 0; i < cnt; i++)
+        reqs[i]->waiter = &done;
+      sema_down (&done);
+    }
+  for (i = 0; i < cnt; i++)
+    reqs[i]->waiter = NULL;
+  intr_set_level (old_level);
+
+  return r;
+}
+
+/* Called by the driver of BLOCK when the transfer it was last
+   asked to start has completed.  Starts the next transfer, if
+   any, and then notifies the submitters of the requests that
+   were just completed. */
+void
+block_complete (struct block *block)
+{
+  struct block_queue *q = block->queue;
+  struct block_request *first;
+  struct list finished;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  ASSERT (q->batch_cnt != 0);
+
+  first = list_entry (list_front (&q->batch), struct block_request, elem);
+  if (!first->write && list_front (&q->batch) != list_back (&q->batch))
+    copy_batch (q, false);
+
+  list_init (&finished);
+  while (!list_empty (&q->batch))
+    list_push_back (&finished, list_pop_front (&q->batch));
+  q->batch_cnt = 0;
+  dispatch (block);
+
+  while (!list_empty (&finished))
+    finish_request (list_entry (list_pop_front (&finished),
+                                struct block_request, elem));
+  intr_set_level (old_level);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +588,44 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Returns the device that BLOCK is a partition of and stores the
+   sector at which BLOCK starts on it in *START.  If BLOCK is not
+   a partition, returns a null pointer and stores 0. */
+struct block *
+block_parent (struct block *block, block_sector_t *start)
+{
+  *start = block->parent != NULL ? block->start : 0;
+  return block->parent;
+}
+
+/* Prints the nonempty buckets of latency histogram HIST, for
+   requests of kind WHAT on the block device named NAME, if it
+   has any. */
+static void
+print_latency (const char *name, const char *what, const uint32_t hist[])
+{
+  bool any = false;
+  int i;
+
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    if (hist[i] != 0)
+      {
+        if (!any)
+          printf ("%s: %s latency (log2 cycles: count):", name, what);
+        any = true;
+        printf (" %d:%"PRIu32, i, hist[i]);
+      }
+  if (any)
+    printf ("\n");
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role, then details for every block device that has had any
+   requests. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -171,18 +633,59 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %"PRIu64" reads, %"PRIu64" writes\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->stats.read_cnt, block->stats.write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      const struct block_stats *s = &block->stats;
+      uint64_t reqs = s->read_reqs + s->write_reqs;
+
+      if (reqs == 0)
+        continue;
+      printf ("%s: %"PRIu64" read requests (%"PRIu64" bytes), "
+              "%"PRIu64" write requests (%"PRIu64" bytes), "
+              "%"PRIu64"%% sequential, max queue depth %"PRIu32"\n",
+              block->name, s->read_reqs, s->read_cnt * BLOCK_SECTOR_SIZE,
+              s->write_reqs, s->write_cnt * BLOCK_SECTOR_SIZE,
+              s->seq_reqs * 100 / reqs, s->max_depth);
+      print_latency (block->name, "read", s->read_latency);
+      print_latency (block->name, "write", s->write_latency);
+    }
+}
+
+/* Copies the statistics of up to CNT block devices into STATS,
+   in the order that the devices were registered.  Returns the
+   number of block devices, which may be more than CNT. */
+size_t
+block_get_stats (struct block_stats *stats, size_t cnt)
+{
+  struct list_elem *e;
+  size_t i = 0;
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e), i++)
+    if (i < cnt)
+      {
+        struct block *block = list_entry (e, struct block, list_elem);
+        enum intr_level old_level = intr_disable ();
+        stats[i] = block->stats;
+        intr_set_level (old_level);
+      }
+  return i;
 }
 
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
    be provided, as well as the it operation functions OPS, which
-   will be passed AUX in each function call. */
+   will be passed AUX in each function call.  OPS is null only
+   for partitions; see block_register_partition(). */
 struct block *
 block_register (const char *name, enum block_type type,
                 const char *extra_info, block_sector_t size,
@@ -198,8 +701,25 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  strlcpy (block->stats.name, name, sizeof block->stats.name);
+  block->next_sector = 0;
+  block->depth = 0;
+  block->parent = NULL;
+  block->start = 0;
+  block->queue = NULL;
+  if (ops != NULL && ops->start != NULL)
+    {
+      struct block_queue *q = malloc (sizeof *q);
+      if (q == NULL)
+        PANIC ("Failed to allocate request queue for block device");
+      list_init (&q->requests);
+      list_init (&q->batch);
+      q->batch_cnt = 0;
+      q->head = 0;
+      q->merge_buffer = malloc (MERGE_MAX * BLOCK_SECTOR_SIZE);
+      block->queue = q;
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +731,25 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Registers a new block device named NAME, as block_register(),
+   that consists of the SIZE sectors of PARENT starting at sector
+   START.  Requests to the new device are passed along to
+   PARENT. */
+struct block *
+block_register_partition (const char *name, enum block_type type,
+                          const char *extra_info, struct block *parent,
+                          block_sector_t start, block_sector_t size)
+{
+  struct block *block;
+
+  ASSERT (start <= parent->size && size <= parent->size - start);
+
+  block = block_register (name, type, extra_info, size, NULL, NULL);
+  block->parent = parent;
+  block->start = start;
+  return block;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +54,99 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *, size_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           size_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
+struct block *block_parent (struct block *, block_sector_t *start);
+
+/* Asynchronous requests.
+
+   A request moves CNT consecutive sectors starting at SECTOR
+   between the device and BUFFER, which must have room for
+   CNT * BLOCK_SECTOR_SIZE bytes.  block_submit() returns at once.
+   Once the transfer is complete, block_poll() returns true for
+   the request, block_wait_any() can return it, and then DONE, if
+   nonnull, is called.  The caller must not touch BUFFER, or the
+   request other than through block_poll() and block_wait_any(),
+   until then.
+
+   On a device whose driver supports asynchronous transfers,
+   requests are carried out in elevator order, not the order in
+   which they were submitted, so a caller must wait for a request
+   to complete before submitting another that overlaps it.  DONE
+   is then called from an interrupt handler, so it must not
+   sleep.  On other devices, block_submit() performs the transfer
+   and calls DONE before it returns. */
+struct block_request;
+typedef void block_done_func (struct block_request *);
+
+struct block_request
+  {
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* Data to write or room to read. */
+    bool write;                 /* True to write, false to read. */
+    block_done_func *done;      /* Called on completion, if nonnull. */
+    void *aux;                  /* For use by DONE. */
+
+    /* Owned by the block layer. */
+    struct block *block;        /* Device submitted to. */
+    uint64_t start_time;        /* CPU cycle count at submission. */
+    volatile bool completed;    /* Transfer complete? */
+    struct semaphore *waiter;   /* Up'd on completion, if nonnull. */
+    block_sector_t dev_sector;  /* SECTOR on the queue's device. */
+    struct list_elem elem;      /* Element in device's queue. */
+    int64_t deadline;           /* Timer tick by which to start it. */
+  };
+
+void block_submit (struct block *, struct block_request *);
+bool block_poll (const struct block_request *);
+struct block_request *block_wait_any (struct block_request *[], size_t cnt);
 
 /* Statistics. */
+struct block_stats;
 void block_print_stats (void);
-
-/* Lower-level interface to block device drivers. */
+size_t block_get_stats (struct block_stats *, size_t cnt);
+
+/* Lower-level interface to block device drivers.
+
+   A driver provides either READ and WRITE, which transfer a
+   sector and return once it is done, or START.
+
+   READ_MULTIPLE and WRITE_MULTIPLE transfer CNT consecutive
+   sectors to or from a buffer of CNT * BLOCK_SECTOR_SIZE bytes.
+   They are optional: for a driver that leaves them null, the
+   block layer calls READ or WRITE once per sector instead.
+
+   START begins a transfer of CNT sectors and returns at once.
+   The driver calls block_complete() when the transfer is done,
+   typically from its interrupt handler, but never from within
+   START itself.  The block layer calls START with interrupts
+   turned off and never starts a new transfer on a device until
+   the previous one completes. */
 
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           size_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            size_t cnt);
+    void (*start) (void *aux, block_sector_t, void *buffer, size_t cnt,
+                   bool write);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+struct block *block_register_partition (const char *name, enum block_type,
+                                        const char *extra_info,
+                                        struct block *parent,
+                                        block_sector_t start,
+                                        block_sector_t size);
+void block_complete (struct block *);
 
 #endif /* devices/block.h */
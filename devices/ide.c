@@ -3,12 +3,15 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +37,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +53,44 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master IDE port addresses, per [SFF-8038i].  The PCI IDE
+   controller has one set of these registers for each channel. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ACTIVE 0x01      /* Transfer in progress. */
+#define BM_STA_ERROR 0x02       /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Disk interrupted (write 1 to clear). */
+
+/* A Physical Region Descriptor, which describes one physically
+   contiguous piece of the memory taking part in a DMA transfer.
+   A piece may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last descriptor. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Most sectors that one READ or WRITE command can transfer.  A
+   sector count register value of 0 means 256. */
+#define MAX_SECTORS 256
+
+/* Number of descriptors in each channel's PRD table.  A transfer
+   of MAX_SECTORS sectors spans 128 kB, which crosses a 64 kB
+   boundary at most twice, so it needs at most three
+   descriptors. */
+#define PRD_CNT 3
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +99,19 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer data by DMA instead of PIO? */
+    struct block *block;        /* Block device, once registered. */
+
+    /* The transfer that the block layer last started, which is
+       either in progress or waiting for the channel. */
+    bool waiting;               /* Waiting for the channel? */
+    bool write;                 /* Writing to the disk? */
+    block_sector_t sec_no;      /* Next sector to transfer. */
+    uint8_t *buffer;            /* Data for sector SEC_NO. */
+    size_t cnt;                 /* Sectors left in the transfer. */
+    size_t cmd_cnt;             /* Sectors left in the current command. */
+    bool dma;                   /* Current command uses DMA? */
+    bool bounce;                /* Through the channel's bounce buffer? */
   };
 
 /* An ATA channel (aka controller).
@@ -67,11 +122,15 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
-    bool expecting_interrupt;   /* True if an interrupt is expected, false if
-                                   any interrupt would be spurious. */
+    struct ata_disk *active;    /* Disk whose transfer is in progress. */
+    bool expecting_interrupt;   /* True if an interrupt is expected while
+                                   identifying a disk. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base I/O port, 0 if none. */
+    struct prd *prdt;           /* PRD table, if bm_base is nonzero. */
+    uint8_t *bounce;            /* Sector for buffers DMA can't use. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -79,28 +138,38 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+bool ide_dma;
+
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
+static void issue_command (struct ata_disk *);
+static void transfer_interrupt (struct channel *);
+
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool wait_for_drq (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static uint16_t find_bus_master (void);
+static void fill_prdt (struct channel *, const void *, size_t size);
+
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = ide_dma ? find_bus_master () : 0;
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,9 +192,20 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      c->active = NULL;
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Set up DMA, if it was asked for and the controller
+         supports it. */
+      c->bm_base = 0;
+      if (bm_base != 0)
+        {
+          c->prdt = malloc (PRD_CNT * sizeof *c->prdt);
+          c->bounce = malloc (BLOCK_SECTOR_SIZE);
+          if (c->prdt != NULL && c->bounce != NULL)
+            c->bm_base = bm_base + 8 * chan_no;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +216,9 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
+          d->block = NULL;
+          d->waiting = false;
         }
 
       /* Register interrupt handler. */
@@ -286,8 +369,10 @@ identify_ata_device (struct ata_disk *d)
   capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
+  d->use_dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->use_dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -306,6 +391,7 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  d->block = block;
   partition_scan (block);
 }
 
@@ -337,63 +423,54 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Starts transferring CNT sectors between SEC_NO on disk D and
+   BUFFER, reading from the disk if WRITE is false and writing to
+   it otherwise, and returns at once.  The interrupt handler
+   carries the transfer through to the end and then reports it to
+   the block layer.  If the other disk on the channel is busy, the
+   transfer starts once that disk's transfer is done. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_start (void *d_, block_sector_t sec_no, void *buffer, size_t cnt,
+           bool write)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
-}
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
-{
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->active != d && !d->waiting);
+
+  d->write = write;
+  d->sec_no = sec_no;
+  d->buffer = buffer;
+  d->cnt = cnt;
+  if (c->active == NULL)
+    {
+      c->active = d;
+      issue_command (d);
+    }
+  else
+    d->waiting = true;
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    .start = ide_start,
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_SECTORS, to the disk's sector selection registers.  (We
    use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +479,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Used only while identifying disks. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -430,6 +507,241 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus master DMA. */
+
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit register at offset REG in the configuration
+   space of PCI function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit register at offset REG in the configuration
+   space of PCI function FUNC of device DEV on bus 0 to VALUE. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that runs both
+   channels at the legacy ports we use and can act as a bus
+   master, as the PIIX controllers that QEMU and Bochs emulate
+   do.  If there is one, enables bus mastering on it and returns
+   the base I/O port of its bus master registers.  Otherwise,
+   returns 0, and we use PIO only. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4;
+
+        if ((pci_read_config (dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+        class = pci_read_config (dev, func, 0x08) >> 8;
+        if ((class >> 8) != 0x0101      /* Mass storage, IDE. */
+            || (class & 0x80) == 0      /* Bus master capable. */
+            || (class & 0x05) != 0)     /* Both channels legacy. */
+          continue;
+
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space access and bus mastering. */
+        pci_write_config (dev, func, 0x04,
+                          pci_read_config (dev, func, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Fills in channel C's PRD table to describe the SIZE bytes at
+   kernel virtual address P.  Kernel virtual memory maps physical
+   memory one-to-one, so the buffer is physically contiguous, but
+   it must still be split at each 64 kB boundary. */
+static void
+fill_prdt (struct channel *c, const void *p, size_t size)
+{
+  struct prd *prd = c->prdt;
+  uint32_t addr = vtop (p);
+
+  ASSERT (size > 0 && size <= MAX_SECTORS * BLOCK_SECTOR_SIZE);
+
+  for (;;)
+    {
+      size_t piece = 0x10000 - (addr & 0xffff);
+      if (piece > size)
+        piece = size;
+
+      ASSERT (prd < c->prdt + PRD_CNT);
+      prd->addr = addr;
+      prd->size = piece;        /* 64 kB truncates to 0, as required. */
+      prd->flags = 0;
+
+      addr += piece;
+      size -= piece;
+      if (size == 0)
+        break;
+      prd++;
+    }
+  prd->flags = PRD_EOT;
+}
+
+/* Transfers. */
+
+/* Issues the next command of the transfer on disk D, which must
+   be its channel's active disk: a DMA command for up to
+   MAX_SECTORS sectors if D can use DMA, otherwise a PIO command.
+   Interrupts must be off. */
+static void
+issue_command (struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  size_t cnt = d->cnt < MAX_SECTORS ? d->cnt : MAX_SECTORS;
+
+  ASSERT (c->active == d && d->cnt > 0);
+
+  d->dma = d->use_dma;
+  d->bounce = false;
+  if (d->dma
+      && (!is_kernel_vaddr (d->buffer) || ((uintptr_t) d->buffer & 1) != 0))
+    {
+      /* The controller moves words, so it needs an even address.
+         Go through the bounce buffer a sector at a time. */
+      d->bounce = true;
+      cnt = 1;
+      if (d->write)
+        memcpy (c->bounce, d->buffer, BLOCK_SECTOR_SIZE);
+    }
+  d->cmd_cnt = cnt;
+
+  if (d->dma)
+    {
+      /* Program the controller, issue the command to the disk,
+         then let the controller go. */
+      fill_prdt (c, d->bounce ? c->bounce : d->buffer,
+                 cnt * BLOCK_SECTOR_SIZE);
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      outb (reg_bm_command (c), d->write ? 0 : BM_CMD_READ);
+      outb (reg_bm_status (c), inb (reg_bm_status (c))
+                               | BM_STA_ERROR | BM_STA_INTR);
+      select_sectors (d, d->sec_no, cnt);
+      outb (reg_command (c), d->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c),
+            (d->write ? 0 : BM_CMD_READ) | BM_CMD_START);
+    }
+  else
+    {
+      /* The disk interrupts once for each sector: when it is
+         ready to be read, or once it has been written. */
+      select_sectors (d, d->sec_no, cnt);
+      outb (reg_command (c),
+            d->write ? CMD_WRITE_SECTOR_RETRY : CMD_READ_SECTOR_RETRY);
+      if (d->write)
+        {
+          if (!wait_for_drq (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, d->sec_no);
+          output_sector (c, d->buffer);
+        }
+    }
+}
+
+/* Advances disk D's transfer past CNT sectors. */
+static void
+advance (struct ata_disk *d, size_t cnt)
+{
+  d->sec_no += cnt;
+  d->buffer += cnt * BLOCK_SECTOR_SIZE;
+  d->cnt -= cnt;
+  d->cmd_cnt -= cnt;
+}
+
+/* Handles an interrupt from channel C's active disk: moves the
+   next sector of a PIO command, or finishes a DMA command.  Once
+   the active disk's transfer is done, starts the other disk's
+   waiting transfer, if any, and reports completion to the block
+   layer. */
+static void
+transfer_interrupt (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+  struct ata_disk *other;
+  uint8_t status;
+
+  if (d->dma)
+    {
+      uint8_t bm_status;
+
+      outb (reg_bm_command (c), 0);
+      bm_status = inb (reg_bm_status (c));
+      outb (reg_bm_status (c), bm_status | BM_STA_ERROR | BM_STA_INTR);
+      status = inb (reg_status (c));    /* Acknowledge interrupt. */
+      if ((bm_status & BM_STA_ERROR) != 0 || (status & STA_ERR) != 0)
+        {
+          printf ("%s: DMA failed, sector=%"PRDSNu", falling back to PIO\n",
+                  d->name, d->sec_no);
+          d->use_dma = false;
+          issue_command (d);
+          return;
+        }
+      if (d->bounce && !d->write)
+        memcpy (d->buffer, c->bounce, BLOCK_SECTOR_SIZE);
+      advance (d, d->cmd_cnt);
+    }
+  else
+    {
+      status = inb (reg_status (c));    /* Acknowledge interrupt. */
+      if ((status & STA_ERR) != 0
+          || (!d->write && (status & STA_DRQ) == 0))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, d->write ? "write" : "read", d->sec_no);
+      if (!d->write)
+        input_sector (c, d->buffer);
+      advance (d, 1);
+      if (d->cmd_cnt > 0)
+        {
+          if (d->write)
+            {
+              if ((status & STA_DRQ) == 0)
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, d->sec_no);
+              output_sector (c, d->buffer);
+            }
+          return;
+        }
+    }
+
+  if (d->cnt > 0)
+    {
+      issue_command (d);
+      return;
+    }
+
+  /* D's transfer is done.  Give the channel to the other disk. */
+  c->active = NULL;
+  other = &c->devices[1 - d->dev_no];
+  if (other->waiting)
+    {
+      other->waiting = false;
+      c->active = other;
+      issue_command (other);
+    }
+  block_complete (d->block);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -446,7 +758,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,6 +791,25 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Waits up to a second for disk D to clear BSY, and then
+   returns the status of the DRQ bit.  Unlike wait_while_busy(),
+   never sleeps, so that it can be used in an interrupt handler. */
+static bool
+wait_for_drq (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 100000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if ((status & STA_BSY) == 0)
+        return (status & STA_DRQ) != 0;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +820,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,8 +842,11 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt) 
+        if (c->active != NULL)
+          transfer_interrupt (c);
+        else if (c->expecting_interrupt) 
           {
+            c->expecting_interrupt = false;
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
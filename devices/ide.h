@@ -1,6 +1,14 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* Transfer data by bus-master DMA on disks that support it,
+   instead of by PIO?  Off by default, since the DMA path has not
+   yet been run under QEMU or Bochs.
+   Controlled by kernel command-line option "-dma". */
+extern bool ide_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
@@ -0,0 +1,164 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device whose sectors are kept in kernel memory, so
+   that transfers cost a memcpy() instead of a trip to the disk.
+   Its contents are lost at power off.
+
+   The sectors are spread over separately allocated pages, since
+   the kernel pool seldom has a large enough run of contiguous
+   pages to hold a disk of any size. */
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    block_sector_t size;        /* Size in sectors. */
+    uint8_t **pages;            /* Pages holding the sectors. */
+  };
+
+/* Returns the address of SECTOR in RD's memory.  The sectors
+   from SECTOR to the end of its page follow it contiguously. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the number of sectors, up to CNT, from SECTOR to the
+   end of the page that contains it. */
+static size_t
+run_length (block_sector_t sector, size_t cnt)
+{
+  size_t left = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+  return cnt < left ? cnt : left;
+}
+
+/* Reads CNT sectors starting at SECTOR from RD_ into BUFFER. */
+static void
+ramdisk_read_multiple (void *rd_, block_sector_t sector, void *buffer,
+                       size_t cnt)
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *p = buffer;
+
+  while (cnt > 0)
+    {
+      size_t run = run_length (sector, cnt);
+      memcpy (p, sector_addr (rd, sector), run * BLOCK_SECTOR_SIZE);
+      sector += run;
+      p += run * BLOCK_SECTOR_SIZE;
+      cnt -= run;
+    }
+}
+
+/* Writes CNT sectors starting at SECTOR to RD_ from BUFFER. */
+static void
+ramdisk_write_multiple (void *rd_, block_sector_t sector,
+                        const void *buffer, size_t cnt)
+{
+  struct ramdisk *rd = rd_;
+  const uint8_t *p = buffer;
+
+  while (cnt > 0)
+    {
+      size_t run = run_length (sector, cnt);
+      memcpy (sector_addr (rd, sector), p, run * BLOCK_SECTOR_SIZE);
+      sector += run;
+      p += run * BLOCK_SECTOR_SIZE;
+      cnt -= run;
+    }
+}
+
+/* Reads sector SECTOR from RD into BUFFER. */
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (rd, sector, buffer, 1);
+}
+
+/* Writes sector SECTOR to RD from BUFFER. */
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (rd, sector, buffer, 1);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+    .read_multiple = ramdisk_read_multiple,
+    .write_multiple = ramdisk_write_multiple,
+  };
+
+/* Copies as much of block device SOURCE as fits into RD, which
+   is registered as BLOCK, a page at a time. */
+static void
+preload (struct ramdisk *rd, struct block *block, struct block *source)
+{
+  block_sector_t cnt = block_size (source);
+  block_sector_t sector;
+
+  if (cnt > rd->size)
+    cnt = rd->size;
+  for (sector = 0; sector < cnt; sector += SECTORS_PER_PAGE)
+    block_read_multiple (source, sector, sector_addr (rd, sector),
+                         run_length (sector, cnt - sector));
+  printf ("%s: loaded %'"PRDSNu" sectors from %s\n",
+          block_name (block), cnt, block_name (source));
+}
+
+/* Creates a RAM disk of SECTORS sectors, initially all zeros,
+   and registers it as block device "ram0" of type ROLE.  If
+   SOURCE is nonnull, it names a block device whose contents are
+   copied into the RAM disk.  The memory comes from the kernel
+   pool, so the kernel panics if there is not enough of it.
+   Returns the new block device. */
+struct block *
+ramdisk_init (size_t sectors, enum block_type role, const char *source)
+{
+  struct ramdisk *rd;
+  struct block *block;
+  struct block *src = NULL;
+  size_t page_cnt = DIV_ROUND_UP (sectors, SECTORS_PER_PAGE);
+  size_t i;
+
+  ASSERT (role < BLOCK_ROLE_CNT);
+  ASSERT (sectors <= RAMDISK_MAX_KB * 1024 / BLOCK_SECTOR_SIZE);
+
+  if (source != NULL)
+    {
+      src = block_get_by_name (source);
+      if (src == NULL)
+        PANIC ("No such block device \"%s\" to load RAM disk from", source);
+    }
+
+  rd = malloc (sizeof *rd);
+  if (rd != NULL)
+    rd->pages = malloc (page_cnt * sizeof *rd->pages);
+  if (rd == NULL || rd->pages == NULL)
+    PANIC ("Failed to allocate memory for RAM disk descriptor");
+  rd->size = sectors;
+  for (i = 0; i < page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("Not enough kernel memory for a %zu kB RAM disk",
+               sectors * BLOCK_SECTOR_SIZE / 1024);
+    }
+
+  block = block_register ("ram0", role, "RAM disk", sectors,
+                          &ramdisk_operations, rd);
+  if (src != NULL)
+    preload (rd, block, src);
+  return block;
+}
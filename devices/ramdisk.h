@@ -0,0 +1,14 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Largest RAM disk, in kB.  Pintos uses at most 64 MB of RAM, so
+   no bigger disk could fit in memory. */
+#define RAMDISK_MAX_KB (64 * 1024)
+
+struct block *ramdisk_init (size_t sectors, enum block_type role,
+                            const char *source);
+
+#endif /* devices/ramdisk.h */
@@ -1,6 +1,7 @@
 #include "devices/shutdown.h"
 #include <console.h>
 #include <stdio.h>
+#include "devices/block-trace.h"
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
@@ -94,6 +95,7 @@ shutdown_power_off (void)
   filesys_done ();
 #endif
 
+  block_trace_dump ();
   print_stats ();
 
   printf ("Powering off...\n");
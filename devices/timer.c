@@ -1,6 +1,7 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
@@ -20,6 +21,19 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* A thread waiting in timer_sema_down(). */
+struct alarm
+  {
+    int64_t wakeup;                     /* Tick at which to give up. */
+    struct semaphore *sema;             /* Semaphore being waited on. */
+    bool fired;                         /* Did the wait time out? */
+    struct list_elem elem;              /* Element in ALARMS. */
+  };
+
+/* Alarms not yet fired, soonest first.  Protected by disabling
+   interrupts. */
+static struct list alarms;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -35,6 +49,7 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  list_init (&alarms);
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -96,6 +111,53 @@ timer_sleep (int64_t ticks)
     thread_yield ();
 }
 
+/* Orders alarms by ascending wakeup tick. */
+static bool
+alarm_less (const struct list_elem *a_, const struct list_elem *b_,
+            void *aux UNUSED)
+{
+  const struct alarm *a = list_entry (a_, struct alarm, elem);
+  const struct alarm *b = list_entry (b_, struct alarm, elem);
+
+  return a->wakeup < b->wakeup;
+}
+
+/* Downs SEMA, but gives up after approximately TICKS timer ticks.
+   Returns true if SEMA was downed, false if the wait timed out.
+   The thread is blocked while it waits.  No other thread may be
+   waiting on SEMA.  Interrupts must be turned on. */
+bool
+timer_sema_down (struct semaphore *sema, int64_t ticks)
+{
+  struct alarm a;
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  if (sema_try_down (sema))
+    success = true;
+  else if (ticks <= 0)
+    success = false;
+  else
+    {
+      a.wakeup = ticks + timer_ticks ();
+      a.sema = sema;
+      a.fired = false;
+      list_insert_ordered (&alarms, &a.elem, alarm_less, NULL);
+
+      /* If the alarm fires, it ups SEMA to wake us, and we take
+         that up back here. */
+      sema_down (sema);
+      success = !a.fired;
+      if (success)
+        list_remove (&a.elem);
+    }
+  intr_set_level (old_level);
+  return success;
+}
+
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
 void
@@ -171,6 +233,15 @@ static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
+  while (!list_empty (&alarms))
+    {
+      struct alarm *a = list_entry (list_front (&alarms), struct alarm, elem);
+      if (a->wakeup > ticks)
+        break;
+      list_pop_front (&alarms);
+      a->fired = true;
+      sema_up (a->sema);
+    }
   thread_tick ();
 }
 
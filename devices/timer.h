@@ -2,8 +2,11 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+struct semaphore;
+
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
@@ -19,6 +22,8 @@ void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+bool timer_sema_down (struct semaphore *, int64_t ticks);
+
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
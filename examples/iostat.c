@@ -0,0 +1,61 @@
+/* iostat.c
+
+   Prints the statistics that the kernel keeps for each block
+   device: request counts and sizes, how many requests were
+   sequential, the deepest the device's queue has been, and a
+   histogram of request latencies.  This won't work until
+   project 4. */
+
+#include <syscall.h>
+#include <stdio.h>
+
+#define MAX_DEVICES 16
+
+/* Prints the nonempty buckets of latency histogram HIST for
+   requests of kind WHAT. */
+static void
+print_latency (const char *what, const uint32_t hist[])
+{
+  int i;
+
+  printf ("  %s latency (log2 cycles: count):", what);
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" %d:%u", i, (unsigned) hist[i]);
+  printf ("\n");
+}
+
+int
+main (void)
+{
+  static struct block_stats stats[MAX_DEVICES];
+  int cnt, i;
+
+  cnt = blockstats (stats, MAX_DEVICES);
+  if (cnt < 0)
+    {
+      printf ("iostat: blockstats failed\n");
+      return 1;
+    }
+  if (cnt > MAX_DEVICES)
+    cnt = MAX_DEVICES;
+
+  for (i = 0; i < cnt; i++)
+    {
+      const struct block_stats *s = &stats[i];
+      unsigned long long reqs = s->read_reqs + s->write_reqs;
+
+      printf ("%s: %llu reads in %llu requests, "
+              "%llu writes in %llu requests",
+              s->name, s->read_cnt, s->read_reqs,
+              s->write_cnt, s->write_reqs);
+      if (reqs > 0)
+        printf (", %llu%% sequential", s->seq_reqs * 100 / reqs);
+      printf (", max queue depth %u\n", (unsigned) s->max_depth);
+      if (s->read_reqs > 0)
+        print_latency ("read", s->read_latency);
+      if (s->write_reqs > 0)
+        print_latency ("write", s->write_latency);
+    }
+  return 0;
+}
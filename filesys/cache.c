@@ -0,0 +1,729 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A cached copy of one sector of the file system device.
+
+   SECTOR and IN_USE change only while holding both cache_lock
+   and the entry's LOCK, so holding either one is enough to read
+   them.  DIRTY, JOURNALED, and DATA are protected by LOCK alone.
+   ACCESSED is only a hint for the clock algorithm and is not
+   locked.
+
+   A JOURNALED entry holds metadata changed by the running
+   journal transaction.  It is dirty, but it stays in the cache
+   and is not written back until the transaction commits. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if in use. */
+    bool in_use;                        /* Holds a valid sector? */
+    bool dirty;                         /* Modified since last written? */
+    bool journaled;                     /* Held for the journal? */
+    bool accessed;                      /* Used since clock hand passed? */
+    struct lock lock;                   /* Per-entry lock. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+/* The cache itself. */
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the mapping from sectors to entries and the clock
+   hand.  Never block on an entry's lock while holding this. */
+static struct lock cache_lock;
+
+/* Next entry the clock algorithm will consider for eviction. */
+static size_t clock_hand;
+
+/* Sectors waiting to be read by the read-ahead daemon.
+   Requests that arrive while the queue is full are dropped,
+   since read-ahead is only a hint. */
+#define READ_AHEAD_QUEUE 16
+static block_sector_t ra_queue[READ_AHEAD_QUEUE];
+static size_t ra_head;                  /* Index of oldest request. */
+static size_t ra_cnt;                   /* Number of queued requests. */
+static struct lock ra_lock;             /* Protects the queue. */
+static struct condition ra_nonempty;    /* Signaled when a request arrives. */
+
+/* Write-behind.  The flusher thread writes dirty entries back
+   every cache_flush_interval milliseconds, or sooner once more
+   than CACHE_DIRTY_MAX entries are dirty or eviction has had to
+   write back a dirty entry itself.  With an interval of 0, it
+   writes back only in those cases. */
+#define CACHE_DIRTY_MAX (CACHE_SIZE / 2)
+unsigned cache_flush_interval = 1000;
+static int dirty_cnt;                   /* Number of dirty entries. */
+static size_t journaled_cnt;            /* Number of journaled entries. */
+
+/* Most consecutive dirty sectors that cache_flush() writes back
+   with a single request to the device. */
+#define FLUSH_RUN 8
+
+/* Wakes the flusher before the interval ends.  FLUSH_WANTED is
+   set at most once per wakeup, so that FLUSH_SEMA is up at most
+   once, and is protected by disabling interrupts. */
+static bool flush_wanted;               /* Flusher woken early? */
+static struct semaphore flush_sema;     /* Upped to wake the flusher. */
+
+static thread_func read_ahead_daemon NO_RETURN;
+static thread_func flush_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  ASSERT (cache_flush_interval <= CACHE_FLUSH_MAX);
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->in_use = false;
+      e->dirty = false;
+      e->journaled = false;
+      e->accessed = false;
+      lock_init (&e->lock);
+    }
+  clock_hand = 0;
+
+  ra_head = ra_cnt = 0;
+  lock_init (&ra_lock);
+  cond_init (&ra_nonempty);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+
+  dirty_cnt = 0;
+  journaled_cnt = 0;
+  flush_wanted = false;
+  sema_init (&flush_sema, 0);
+  thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL);
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer if
+   SECTOR is not cached.  The caller must hold cache_lock. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Wakes the flusher, unless it has already been woken and has
+   not run yet. */
+static void
+wake_flusher (void)
+{
+  enum intr_level old_level = intr_disable ();
+  if (!flush_wanted)
+    {
+      flush_wanted = true;
+      sema_up (&flush_sema);
+    }
+  intr_set_level (old_level);
+}
+
+/* Marks E dirty, waking the flusher early if too many entries
+   are dirty.  The caller must hold E's lock. */
+static void
+mark_dirty (struct cache_entry *e)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->dirty)
+    return;
+  e->dirty = true;
+
+  old_level = intr_disable ();
+  if (++dirty_cnt > CACHE_DIRTY_MAX)
+    wake_flusher ();
+  intr_set_level (old_level);
+}
+
+/* Marks E, which is dirty and has just been written to disk,
+   clean.  The caller must hold E's lock. */
+static void
+mark_clean (struct cache_entry *e)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock_held_by_current_thread (&e->lock));
+  ASSERT (e->dirty);
+
+  e->dirty = false;
+
+  old_level = intr_disable ();
+  dirty_cnt--;
+  intr_set_level (old_level);
+}
+
+/* Marks E, which is dirty, as held for the running journal
+   transaction, waking the flusher early to commit once the
+   transaction is half full.  Journal operations reserve room for
+   everything they change, so the transaction cannot overflow.
+   The caller must hold E's lock. */
+static void
+mark_journaled (struct cache_entry *e)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock_held_by_current_thread (&e->lock));
+  ASSERT (e->dirty);
+
+  if (e->journaled)
+    return;
+
+  old_level = intr_disable ();
+  if (journaled_cnt >= JOURNAL_SLOTS)
+    PANIC ("journal transaction overflow at sector %"PRDSNu, e->sector);
+  e->journaled = true;
+  if (++journaled_cnt >= JOURNAL_SLOTS / 2)
+    wake_flusher ();
+  intr_set_level (old_level);
+}
+
+/* Writes E back to disk if it is dirty and not held for the
+   journal.  The caller must hold E's lock. */
+static void
+write_back (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->in_use && e->dirty && !e->journaled)
+    {
+      block_write (fs_device, e->sector, e->data);
+      mark_clean (e);
+    }
+}
+
+/* Advances the clock hand until it finds an entry that is free
+   or has not been accessed since the hand last passed it, and
+   that is neither locked by another thread nor held for the
+   journal.  Returns that entry, locked, or a null pointer if
+   every entry is busy.  The caller must hold cache_lock. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      /* JOURNALED is checked again once we hold the lock. */
+      if (e->journaled || !lock_try_acquire (&e->lock))
+        continue;
+      if (!e->journaled && (!e->in_use || !e->accessed))
+        return e;
+      e->accessed = false;
+      lock_release (&e->lock);
+    }
+  return NULL;
+}
+
+/* Returns the cache entry for SECTOR, locked by the current
+   thread.  If SECTOR is not yet cached, evicts some other entry
+   to make room for it and sets *CLAIMED to true, in which case
+   the caller must fill in all of the entry's data before
+   releasing its lock; otherwise, sets *CLAIMED to false. */
+static struct cache_entry *
+get_entry (block_sector_t sector, bool *claimed)
+{
+  struct cache_entry *e;
+
+  *claimed = false;
+  for (;;)
+    {
+      lock_acquire (&cache_lock);
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          /* Cache hit.  E might be evicted between releasing
+             cache_lock and acquiring its lock, so check that it
+             still holds SECTOR once we have it. */
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          if (e->in_use && e->sector == sector)
+            break;
+          lock_release (&e->lock);
+          continue;
+        }
+
+      /* Cache miss.  Find an entry to evict. */
+      e = choose_victim ();
+      if (e == NULL)
+        {
+          lock_release (&cache_lock);
+          thread_yield ();
+          continue;
+        }
+      if (e->in_use && e->dirty)
+        {
+          /* Write the victim back without holding cache_lock,
+             then start over, since another thread may bring
+             SECTOR in while we are busy.  Having to do this at
+             all means the flusher is falling behind. */
+          wake_flusher ();
+          lock_release (&cache_lock);
+          write_back (e);
+          lock_release (&e->lock);
+          continue;
+        }
+
+      /* Claim the victim for SECTOR.  Other threads that look up
+         SECTOR from now on wait on E's lock until it is read. */
+      e->sector = sector;
+      e->in_use = true;
+      e->dirty = false;
+      lock_release (&cache_lock);
+      *claimed = true;
+      break;
+    }
+  e->accessed = true;
+  return e;
+}
+
+/* Returns the cache entry for SECTOR, locked by the current
+   thread.  If SECTOR is not yet cached, evicts some other entry
+   to make room for it and, if LOAD is true, reads it from disk.
+   If LOAD is false, the caller must overwrite all of the
+   entry's data before releasing its lock. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  bool claimed;
+  struct cache_entry *e = get_entry (sector, &claimed);
+
+  if (claimed && load)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Reads SIZE bytes starting at byte OFFSET within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, off_t size, off_t offset)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0);
+  ASSERT (offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + offset, size);
+  lock_release (&e->lock);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR.
+   The data reaches the disk when the entry is evicted or the
+   cache is flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   OFFSET within the sector, and returns SECTOR's entry, still
+   locked. */
+static struct cache_entry *
+write_locked (block_sector_t sector, const void *buffer,
+              off_t size, off_t offset)
+{
+  struct cache_entry *e;
+  bool partial = offset != 0 || size != BLOCK_SECTOR_SIZE;
+
+  ASSERT (offset >= 0 && size >= 0);
+  ASSERT (offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, partial);
+  memcpy (e->data + offset, buffer, size);
+  mark_dirty (e);
+  return e;
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   OFFSET within the sector. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                off_t size, off_t offset)
+{
+  lock_release (&write_locked (sector, buffer, size, offset)->lock);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes of metadata from BUFFER into
+   SECTOR.  While the journal is active, the sector reaches the
+   disk only once the running transaction commits. */
+void
+cache_write_meta (block_sector_t sector, const void *buffer)
+{
+  cache_write_meta_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes of metadata from BUFFER into SECTOR,
+   starting at byte OFFSET within the sector, as for
+   cache_write_meta(). */
+void
+cache_write_meta_at (block_sector_t sector, const void *buffer,
+                     off_t size, off_t offset)
+{
+  struct cache_entry *e = write_locked (sector, buffer, size, offset);
+  if (journal_is_active ())
+    mark_journaled (e);
+  lock_release (&e->lock);
+}
+
+/* Orders cache entries by ascending sector number. */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const struct cache_entry *a = *(struct cache_entry *const *) a_;
+  const struct cache_entry *b = *(struct cache_entry *const *) b_;
+
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* A run of up to FLUSH_RUN consecutive dirty entries that
+   cache_flush() writes back with a single request. */
+struct flush_run
+  {
+    struct block_request req;           /* The write. */
+    struct cache_entry *entries[FLUSH_RUN]; /* Entries, locked. */
+    size_t cnt;                         /* Number of entries. */
+  };
+
+/* Waits for the CNT writes in PENDING, submitted by
+   cache_flush(), to complete, and marks each run's entries clean
+   and unlocks them as soon as its write completes. */
+static void
+finish_runs (struct block_request *pending[], size_t cnt)
+{
+  while (cnt > 0)
+    {
+      struct block_request *r = block_wait_any (pending, cnt);
+      struct flush_run *run = r->aux;
+      size_t i;
+
+      for (i = 0; i < run->cnt; i++)
+        {
+          mark_clean (run->entries[i]);
+          lock_release (&run->entries[i]->lock);
+        }
+      for (i = 0; pending[i] != r; i++)
+        continue;
+      pending[i] = pending[--cnt];
+    }
+}
+
+/* Writes every dirty entry not held for the journal back to
+   disk.  Runs of up to FLUSH_RUN consecutive sectors go out as
+   one request, and all of the requests are submitted before
+   waiting for any of them, in ascending sector order, so that
+   the device can carry them out in a single sweep.  Entries
+   that become dirty while the flush is in progress may be left
+   for the next flush.
+
+   Each run's entries stay locked until its write completes.  So
+   that it never waits for a lock while holding others, which
+   could deadlock with the read-ahead daemon, the flush finishes
+   the writes it has submitted before waiting for a busy entry. */
+void
+cache_flush (void)
+{
+  struct cache_entry *dirty[CACHE_SIZE];
+  struct block_request *pending[CACHE_SIZE];
+  size_t dirty_entries = 0;
+  size_t pending_cnt = 0;
+  struct flush_run *runs;
+  uint8_t *buffer;
+  size_t i;
+
+  /* Peeking at DIRTY and SECTOR without the entries' locks is
+     fine here: they are checked again under the lock, and the
+     order only affects performance. */
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].dirty && !cache[i].journaled)
+      dirty[dirty_entries++] = &cache[i];
+  if (dirty_entries == 0)
+    return;
+  qsort (dirty, dirty_entries, sizeof *dirty, compare_sectors);
+
+  /* Without memory for the requests and for gathering each run's
+     data, write one sector at a time. */
+  runs = malloc (dirty_entries * sizeof *runs);
+  buffer = malloc (dirty_entries * BLOCK_SECTOR_SIZE);
+  if (runs == NULL || buffer == NULL)
+    {
+      for (i = 0; i < dirty_entries; i++)
+        {
+          lock_acquire (&dirty[i]->lock);
+          write_back (dirty[i]);
+          lock_release (&dirty[i]->lock);
+        }
+      free (runs);
+      free (buffer);
+      return;
+    }
+
+  i = 0;
+  while (i < dirty_entries)
+    {
+      struct flush_run *run = &runs[pending_cnt];
+      uint8_t *data = buffer + i * BLOCK_SECTOR_SIZE;
+      struct cache_entry *e = dirty[i++];
+      size_t j;
+
+      if (!lock_try_acquire (&e->lock))
+        {
+          finish_runs (pending, pending_cnt);
+          pending_cnt = 0;
+          run = &runs[0];
+          lock_acquire (&e->lock);
+        }
+      if (!e->in_use || !e->dirty || e->journaled)
+        {
+          lock_release (&e->lock);
+          continue;
+        }
+      run->entries[0] = e;
+      run->cnt = 1;
+
+      /* Extend the run with following entries, giving up at the
+         first one that is busy. */
+      while (run->cnt < FLUSH_RUN && i < dirty_entries)
+        {
+          e = dirty[i];
+          if (!lock_try_acquire (&e->lock))
+            break;
+          if (!e->in_use || !e->dirty || e->journaled
+              || e->sector != run->entries[run->cnt - 1]->sector + 1)
+            {
+              lock_release (&e->lock);
+              break;
+            }
+          run->entries[run->cnt++] = e;
+          i++;
+        }
+
+      /* Gather the run's data and submit the write. */
+      for (j = 0; j < run->cnt; j++)
+        memcpy (data + j * BLOCK_SECTOR_SIZE, run->entries[j]->data,
+                BLOCK_SECTOR_SIZE);
+      run->req.sector = run->entries[0]->sector;
+      run->req.cnt = run->cnt;
+      run->req.buffer = data;
+      run->req.write = true;
+      run->req.done = NULL;
+      run->req.aux = run;
+      block_submit (fs_device, &run->req);
+      pending[pending_cnt++] = &run->req;
+    }
+  finish_runs (pending, pending_cnt);
+  free (runs);
+  free (buffer);
+}
+
+/* Copies the sectors held for the journal, of which there may be
+   up to CNT, into DATA, in ascending sector order, and their
+   sector numbers into SECTORS.  Returns the number copied.  The
+   entries stay held until cache_release_journaled() is called,
+   and the caller must make sure that no other thread writes
+   metadata in between. */
+size_t
+cache_collect_journaled (block_sector_t sectors[], uint8_t *data, size_t cnt)
+{
+  struct cache_entry *held[CACHE_SIZE];
+  size_t held_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].journaled)
+      held[held_cnt++] = &cache[i];
+  qsort (held, held_cnt, sizeof *held, compare_sectors);
+
+  ASSERT (held_cnt <= cnt);
+  for (i = 0; i < held_cnt; i++)
+    {
+      struct cache_entry *e = held[i];
+
+      lock_acquire (&e->lock);
+      sectors[i] = e->sector;
+      memcpy (data + i * BLOCK_SECTOR_SIZE, e->data, BLOCK_SECTOR_SIZE);
+      lock_release (&e->lock);
+    }
+  return held_cnt;
+}
+
+/* Returns the number of entries held for the journal. */
+size_t
+cache_journaled_count (void)
+{
+  return journaled_cnt;
+}
+
+/* Lets the entries held for the journal be written back and
+   evicted like any other. */
+void
+cache_release_journaled (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      enum intr_level old_level;
+
+      if (!e->journaled)
+        continue;
+      lock_acquire (&e->lock);
+      old_level = intr_disable ();
+      if (e->journaled)
+        {
+          e->journaled = false;
+          journaled_cnt--;
+        }
+      intr_set_level (old_level);
+      lock_release (&e->lock);
+    }
+}
+
+/* Asks the read-ahead daemon to bring SECTOR into the cache in
+   the background, so that a later read of it does not have to
+   wait for the disk. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&ra_lock);
+  for (i = 0; i < ra_cnt; i++)
+    if (ra_queue[(ra_head + i) % READ_AHEAD_QUEUE] == sector)
+      break;
+  if (i == ra_cnt && ra_cnt < READ_AHEAD_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % READ_AHEAD_QUEUE] = sector;
+      cond_signal (&ra_nonempty, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/* Reads sectors queued by cache_read_ahead() into the cache.
+   Each pass takes every queued sector, claims an entry for each
+   one that is not cached, and submits all of the reads before
+   waiting for any, so that the device can carry them out
+   together.  A thread that asks for a sector while the daemon is
+   reading it waits on the entry's lock, which is released as
+   soon as that sector arrives, and then finds it cached. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  static struct block_request reqs[READ_AHEAD_QUEUE];
+  struct block_request *pending[READ_AHEAD_QUEUE];
+
+  for (;;)
+    {
+      block_sector_t sectors[READ_AHEAD_QUEUE];
+      size_t cnt, pending_cnt, i;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_nonempty, &ra_lock);
+      for (cnt = 0; ra_cnt > 0; cnt++)
+        {
+          sectors[cnt] = ra_queue[ra_head];
+          ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+          ra_cnt--;
+        }
+      lock_release (&ra_lock);
+
+      pending_cnt = 0;
+      for (i = 0; i < cnt; i++)
+        {
+          struct block_request *r = &reqs[pending_cnt];
+          struct cache_entry *e;
+          bool cached, claimed;
+
+          lock_acquire (&cache_lock);
+          cached = lookup (sectors[i]) != NULL;
+          lock_release (&cache_lock);
+          if (cached)
+            continue;
+          e = get_entry (sectors[i], &claimed);
+          if (!claimed)
+            {
+              lock_release (&e->lock);
+              continue;
+            }
+
+          r->sector = sectors[i];
+          r->cnt = 1;
+          r->buffer = e->data;
+          r->write = false;
+          r->done = NULL;
+          r->aux = e;
+          block_submit (fs_device, r);
+          pending[pending_cnt++] = r;
+        }
+
+      while (pending_cnt > 0)
+        {
+          struct block_request *r = block_wait_any (pending, pending_cnt);
+          struct cache_entry *e = r->aux;
+
+          lock_release (&e->lock);
+          for (i = 0; pending[i] != r; i++)
+            continue;
+          pending[i] = pending[--pending_cnt];
+        }
+    }
+}
+
+/* Writes dirty entries back to disk periodically, and early
+   when too much of the cache is dirty or the journal transaction
+   is filling up, so that writers rarely wait for the disk
+   themselves.  Each pass commits the running journal
+   transaction, which logs the changed free map sectors too. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+
+      if (cache_flush_interval == 0)
+        sema_down (&flush_sema);
+      else
+        timer_sema_down (&flush_sema,
+                         DIV_ROUND_UP (cache_flush_interval * TIMER_FREQ,
+                                       1000));
+
+      old_level = intr_disable ();
+      flush_wanted = false;
+      intr_set_level (old_level);
+      journal_commit ();
+    }
+}
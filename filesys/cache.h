@@ -0,0 +1,38 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "filesys/off_t.h"
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Milliseconds between periodic write-behind flushes, or 0 to
+   flush only under memory pressure and at shutdown.
+   Controlled by kernel command-line option "-flush=MS". */
+extern unsigned cache_flush_interval;
+
+/* Longest flush interval, in milliseconds, that can be converted
+   to timer ticks without overflowing an unsigned int. */
+#define CACHE_FLUSH_MAX (UINT_MAX / TIMER_FREQ)
+
+void cache_init (void);
+void cache_flush (void);
+
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, off_t size, off_t offset);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, off_t size, off_t offset);
+void cache_write_meta (block_sector_t, const void *);
+void cache_write_meta_at (block_sector_t, const void *,
+                          off_t size, off_t offset);
+void cache_read_ahead (block_sector_t);
+
+size_t cache_journaled_count (void);
+size_t cache_collect_journaled (block_sector_t[], uint8_t *, size_t cnt);
+void cache_release_journaled (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,139 @@
+#include "filesys/dcache.h"
+#include <hash.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Number of cached lookups.  The cache is direct-mapped: a new
+   entry simply replaces whatever was in its slot. */
+#define DCACHE_SIZE 256
+
+/* A cached lookup of NAME in the directory whose inode is in
+   sector DIR. */
+struct dcache_entry
+  {
+    bool in_use;                        /* Holds a lookup? */
+    bool found;                         /* Does NAME exist? */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    block_sector_t sector;              /* NAME's inode sector, if found. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+
+/* Protects dcache and generation. */
+static struct lock dcache_lock;
+
+/* Incremented by every invalidation.  A lookup that misses in the
+   cache notes the generation before searching the directory, and
+   its result is cached only if no invalidation happened since, so
+   that a result made stale by a concurrent change is not cached. */
+static unsigned generation;
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  lock_init (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    dcache[i].in_use = false;
+  generation = 0;
+}
+
+/* Returns the slot for NAME in directory DIR. */
+static struct dcache_entry *
+slot (block_sector_t dir, const char *name)
+{
+  return &dcache[(hash_string (name) ^ hash_int (dir)) % DCACHE_SIZE];
+}
+
+/* Returns the current generation, to pass to dcache_insert(). */
+unsigned
+dcache_generation (void)
+{
+  unsigned g;
+
+  lock_acquire (&dcache_lock);
+  g = generation;
+  lock_release (&dcache_lock);
+  return g;
+}
+
+/* Looks up NAME in directory DIR in the cache.  If the cache
+   knows the answer, returns true and sets *FOUND to whether NAME
+   exists and, if so, *SECTOR to its inode sector.  Returns false
+   if the directory itself must be searched. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               bool *found, block_sector_t *sector)
+{
+  struct dcache_entry *e = slot (dir, name);
+  bool hit;
+
+  lock_acquire (&dcache_lock);
+  hit = e->in_use && e->dir == dir && !strcmp (e->name, name);
+  if (hit)
+    {
+      *found = e->found;
+      *sector = e->sector;
+    }
+  lock_release (&dcache_lock);
+  return hit;
+}
+
+/* Records that NAME in directory DIR exists, with its inode in
+   SECTOR, if FOUND is true, or that it does not exist.
+   GENERATION is the value dcache_generation() returned before
+   the directory was searched. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               bool found, block_sector_t sector, unsigned generation_)
+{
+  struct dcache_entry *e = slot (dir, name);
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  if (generation_ == generation)
+    {
+      e->in_use = true;
+      e->found = found;
+      e->dir = dir;
+      e->sector = sector;
+      strlcpy (e->name, name, sizeof e->name);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Forgets any cached lookup of NAME in directory DIR.  Must be
+   called whenever NAME is added to or removed from DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dcache_entry *e = slot (dir, name);
+
+  lock_acquire (&dcache_lock);
+  if (e->in_use && e->dir == dir && !strcmp (e->name, name))
+    e->in_use = false;
+  generation++;
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every cached lookup in directory DIR.  Must be called
+   when a directory is created in sector DIR, in case an earlier
+   directory there left entries behind. */
+void
+dcache_purge_dir (block_sector_t dir)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    if (dcache[i].in_use && dcache[i].dir == dir)
+      dcache[i].in_use = false;
+  generation++;
+  lock_release (&dcache_lock);
+}
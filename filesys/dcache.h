@@ -0,0 +1,22 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Directory entry cache.
+
+   Remembers the result of looking up a name in a directory,
+   including that the name does not exist, so that resolving a
+   path does not have to search each directory along the way. */
+
+void dcache_init (void);
+unsigned dcache_generation (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    bool *found, block_sector_t *sector);
+void dcache_insert (block_sector_t dir, const char *name,
+                    bool found, block_sector_t sector, unsigned generation);
+void dcache_invalidate (block_sector_t dir, const char *name);
+void dcache_purge_dir (block_sector_t dir);
+
+#endif /* filesys/dcache.h */
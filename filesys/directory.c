@@ -1,7 +1,11 @@
 #include "filesys/directory.h"
+#include <hash.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -16,12 +20,172 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* On-disk directory layout.
+
+   A directory's data is a header sector followed by bucket
+   sectors, numbered from 1 by their position in the directory.
+   An entry lives in the bucket that the header's table gives
+   for the low DEPTH bits of the hash of its name, so looking up
+   or adding a name reads the header and a single bucket, no
+   matter how big the directory is.
+
+   This is extendible hashing.  A bucket that fills up is split
+   in two on the next bit of the hash, and the table doubles when
+   the bucket being split is already distinguished by all DEPTH
+   bits.  Once DEPTH reaches DIR_MAX_DEPTH a full bucket gets an
+   overflow bucket chained to it instead. */
+#define DIR_MAGIC 0x44495248            /* Identifies a directory header. */
+#define DIR_MAX_DEPTH 7                 /* Most hash bits used. */
+#define DIR_TABLE_SIZE (1 << DIR_MAX_DEPTH)
+#define BUCKET_ENTRIES 25               /* Entries per bucket sector. */
+
+/* Directory header, at the start of the directory's first
+   sector. */
+struct dir_header
+  {
+    unsigned magic;                     /* DIR_MAGIC. */
+    uint32_t depth;                     /* Hash bits used to index TABLE. */
+    uint32_t bucket_cnt;                /* Number of bucket sectors. */
+    uint32_t entry_cnt;                 /* Number of entries in use. */
+    uint16_t table[DIR_TABLE_SIZE];     /* Bucket for each hash value. */
+  };
+
+/* A bucket sector. */
+struct dir_bucket
+  {
+    uint32_t depth;                     /* Hash bits shared by entries. */
+    uint32_t next;                      /* Overflow bucket, or 0. */
+    uint32_t unused;                    /* Pads to one sector. */
+    struct dir_entry entries[BUCKET_ENTRIES];
+  };
+
+/* Returns the hash of NAME. */
+static unsigned
+name_hash (const char *name)
+{
+  return hash_string (name);
+}
+
+/* Returns the byte offset of slot SLOT of bucket B. */
+static off_t
+entry_ofs (uint32_t b, int slot)
+{
+  return (b * BLOCK_SECTOR_SIZE + offsetof (struct dir_bucket, entries)
+          + slot * sizeof (struct dir_entry));
+}
+
+/* Reads bucket B of the directory in INODE into BUCKET.
+   Returns true if successful, false if B is past the end of the
+   directory. */
+static bool
+read_bucket (struct inode *inode, uint32_t b, struct dir_bucket *bucket)
+{
+  return (inode_read_at (inode, bucket, sizeof *bucket, b * BLOCK_SECTOR_SIZE)
+          == sizeof *bucket);
+}
+
+/* Reads the 32-bit header or bucket field at byte offset OFS in
+   INODE into *VALUE.  Returns true if successful. */
+static bool
+read_field (struct inode *inode, off_t ofs, uint32_t *value)
+{
+  return inode_read_at (inode, value, sizeof *value, ofs) == sizeof *value;
+}
+
+/* Writes VALUE to the 32-bit header or bucket field at byte
+   offset OFS in INODE.  Returns true if successful. */
+static bool
+write_field (struct inode *inode, off_t ofs, uint32_t value)
+{
+  return inode_write_at (inode, &value, sizeof value, ofs) == sizeof value;
+}
+
+/* Returns the bucket that holds names with hash HASH in the
+   directory in INODE, or 0 if INODE is not a valid directory. */
+static uint32_t
+hash_to_bucket (struct inode *inode, unsigned hash)
+{
+  uint32_t depth;
+  uint16_t b;
+  off_t ofs;
+
+  if (!read_field (inode, offsetof (struct dir_header, depth), &depth)
+      || depth > DIR_MAX_DEPTH)
+    return 0;
+  ofs = (offsetof (struct dir_header, table)
+         + (hash & ((1u << depth) - 1)) * sizeof b);
+  if (inode_read_at (inode, &b, sizeof b, ofs) != sizeof b)
+    return 0;
+  return b;
+}
+
+/* Adds DELTA to the entry count in the header of the directory in
+   INODE. */
+static void
+adjust_entry_cnt (struct inode *inode, int delta)
+{
+  off_t ofs = offsetof (struct dir_header, entry_cnt);
+  uint32_t cnt;
+
+  if (read_field (inode, ofs, &cnt))
+    write_field (inode, ofs, cnt + delta);
+}
+
+/* Writes an empty directory with 2**DEPTH buckets into INODE,
+   which must be empty.  Returns true if successful. */
+static bool
+format (struct inode *inode, int depth)
+{
+  struct dir_header *h = calloc (1, BLOCK_SECTOR_SIZE);
+  struct dir_bucket *bucket = calloc (1, sizeof *bucket);
+  bool success = false;
+  int i;
+
+  if (h != NULL && bucket != NULL)
+    {
+      h->magic = DIR_MAGIC;
+      h->depth = depth;
+      h->bucket_cnt = 1 << depth;
+      for (i = 0; i < 1 << depth; i++)
+        h->table[i] = i + 1;
+      bucket->depth = depth;
+
+      success = inode_write_at (inode, h, BLOCK_SECTOR_SIZE, 0)
+                == BLOCK_SECTOR_SIZE;
+      for (i = 1; success && i <= 1 << depth; i++)
+        success = inode_write_at (inode, bucket, sizeof *bucket,
+                                  i * BLOCK_SECTOR_SIZE) == sizeof *bucket;
+    }
+  free (h);
+  free (bucket);
+  return success;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry),true);
+  struct inode *inode;
+  int depth = 0;
+  bool success;
+
+  ASSERT (sizeof (struct dir_header) <= BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  while (depth < DIR_MAX_DEPTH
+         && (size_t) BUCKET_ENTRIES << depth < entry_cnt)
+    depth++;
+
+  if (!inode_create (sector, 0, true))
+    return false;
+  dcache_purge_dir (sector);
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  success = format (inode, depth);
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -87,57 +251,181 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_bucket *bucket;
+  uint32_t b;
+  int slot;
+  bool found = false;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return false;
+
+  b = hash_to_bucket (dir->inode, name_hash (name));
+  while (b != 0 && !found && read_bucket (dir->inode, b, bucket))
+    {
+      for (slot = 0; slot < BUCKET_ENTRIES; slot++)
+        {
+          struct dir_entry *e = &bucket->entries[slot];
+          if (e->in_use && !strcmp (name, e->name)) 
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = entry_ofs (b, slot);
+              found = true;
+              break;
+            }
+        }
+      b = bucket->next;
+    }
+
+  free (bucket);
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   The directory is searched only if the directory entry cache
+   does not already know the answer.  The search holds DIR's
+   directory lock for reading, so that lookups in a directory run
+   in parallel but see each change by dir_add() or dir_remove()
+   completely or not at all. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  block_sector_t parent, sector;
+  bool found;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL) && !dir->inode->removed)
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  parent = inode_get_inumber (dir->inode);
+  *inode = NULL;
+  if (dir->inode->removed)
+    return false;
+
+  if (!dcache_lookup (parent, name, &found, &sector))
+    {
+      unsigned generation = dcache_generation ();
+      struct dir_entry e;
+
+      rwlock_acquire_read (&dir->inode->dir_lock);
+      found = lookup (dir, name, &e, NULL);
+      rwlock_release_read (&dir->inode->dir_lock);
+      sector = found ? e.inode_sector : 0;
+      dcache_insert (parent, name, found, sector, generation);
+    }
+  if (found)
+    *inode = inode_open (sector);
 
   return *inode != NULL;
 }
 
+/* Splits bucket B of the directory in INODE in two, moving the
+   entries whose hash has the next bit set into a new bucket at
+   the end of the directory, and doubling the bucket table first
+   if B is already indexed by every bit in use.  B must not have
+   an overflow chain.  Returns true if successful. */
+static bool
+split_bucket (struct inode *inode, uint32_t b)
+{
+  struct dir_header *h = malloc (sizeof *h);
+  struct dir_bucket *old = malloc (sizeof *old);
+  struct dir_bucket *new = calloc (1, sizeof *new);
+  bool success = false;
+  uint32_t d, nb, i;
+  int slot, new_slot = 0;
+
+  if (h == NULL || old == NULL || new == NULL
+      || inode_read_at (inode, h, sizeof *h, 0) != sizeof *h
+      || inode_read_at (inode, old, sizeof *old, b * BLOCK_SECTOR_SIZE)
+         != sizeof *old)
+    goto done;
+  d = old->depth;
+  ASSERT (d < DIR_MAX_DEPTH && old->next == 0);
+
+  /* Double the table if necessary. */
+  if (d == h->depth)
+    {
+      for (i = 0; i < 1u << h->depth; i++)
+        h->table[i + (1u << h->depth)] = h->table[i];
+      h->depth++;
+    }
+
+  /* Move entries with bit D set to the new bucket. */
+  nb = ++h->bucket_cnt;
+  old->depth = new->depth = d + 1;
+  for (slot = 0; slot < BUCKET_ENTRIES; slot++)
+    {
+      struct dir_entry *e = &old->entries[slot];
+      if (e->in_use && (name_hash (e->name) >> d) & 1)
+        {
+          new->entries[new_slot++] = *e;
+          e->in_use = false;
+        }
+    }
+  for (i = 0; i < 1u << h->depth; i++)
+    if (h->table[i] == b && (i >> d) & 1)
+      h->table[i] = nb;
+
+  /* Write the new bucket first, so that the directory grows
+     before anything refers to it. */
+  success = (inode_write_at (inode, new, sizeof *new, nb * BLOCK_SECTOR_SIZE)
+             == sizeof *new
+             && inode_write_at (inode, old, sizeof *old, b * BLOCK_SECTOR_SIZE)
+                == sizeof *old
+             && inode_write_at (inode, h, sizeof *h, 0) == sizeof *h);
+
+ done:
+  free (h);
+  free (old);
+  free (new);
+  return success;
+}
+
+/* Appends an empty overflow bucket to the chain that ends with
+   bucket LAST in the directory in INODE, and returns it, or 0 on
+   failure. */
+static uint32_t
+add_overflow_bucket (struct inode *inode, uint32_t last)
+{
+  struct dir_bucket *bucket = calloc (1, sizeof *bucket);
+  off_t cnt_ofs = offsetof (struct dir_header, bucket_cnt);
+  uint32_t nb = 0;
+
+  if (bucket != NULL
+      && read_field (inode, cnt_ofs, &nb)
+      && read_field (inode, last * BLOCK_SECTOR_SIZE, &bucket->depth))
+    {
+      nb++;
+      if (inode_write_at (inode, bucket, sizeof *bucket,
+                          nb * BLOCK_SECTOR_SIZE) != sizeof *bucket
+          || !write_field (inode, cnt_ofs, nb)
+          || !write_field (inode, last * BLOCK_SECTOR_SIZE
+                           + offsetof (struct dir_bucket, next), nb))
+        nb = 0;
+    }
+  free (bucket);
+  return nb;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), DIR has been
+   removed, or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_bucket *bucket = NULL;
+  unsigned hash;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -147,30 +435,72 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that DIR still exists and NAME is not in use.  Holding
+     the directory lock from here on keeps another thread from
+     adding NAME or removing DIR in the meantime. */
+  rwlock_acquire_write (&dir->inode->dir_lock);
+  if (dir->inode->removed || lookup (dir, name, NULL, NULL))
+    goto done;
+
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  //if(name[0] == '.') e.in_use = false; //???
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  /* Find a free slot in NAME's bucket or its overflow chain,
+     splitting the bucket or extending the chain if it is
+     full, and write the entry there. */
+  hash = name_hash (name);
+  for (;;)
+    {
+      uint32_t head = hash_to_bucket (dir->inode, hash);
+      uint32_t b = head, last = head, depth = 0;
+      int slot;
+
+      if (head == 0)
+        goto done;
+      while (b != 0)
+        {
+          if (!read_bucket (dir->inode, b, bucket))
+            goto done;
+          if (b == head)
+            depth = bucket->depth;
+          for (slot = 0; slot < BUCKET_ENTRIES; slot++)
+            {
+              struct dir_entry *e = &bucket->entries[slot];
+              if (!e->in_use)
+                {
+                  /* Write slot. */
+                  e->in_use = true;
+                  strlcpy (e->name, name, sizeof e->name);
+                  e->inode_sector = inode_sector;
+                  success = (inode_write_at (dir->inode, e, sizeof *e,
+                                             entry_ofs (b, slot))
+                             == sizeof *e);
+                  if (success)
+                    {
+                      adjust_entry_cnt (dir->inode, 1);
+                      dcache_invalidate (inode_get_inumber (dir->inode),
+                                         name);
+                    }
+                  goto done;
+                }
+            }
+          last = b;
+          b = bucket->next;
+        }
+
+      if (depth < DIR_MAX_DEPTH)
+        {
+          if (!split_bucket (dir->inode, head))
+            goto done;
+        }
+      else if (add_overflow_bucket (dir->inode, last) == 0)
+        goto done;
+    }
 
  done:
+  rwlock_release_write (&dir->inode->dir_lock);
+  free (bucket);
   return success;
 }
 
@@ -192,6 +522,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  rwlock_acquire_write (&dir->inode->dir_lock);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -204,36 +535,72 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  adjust_entry_cnt (dir->inode, -1);
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
 
   //if inode is for parent directory don't remove
   if(thread_current()->currentDir != NULL && thread_current()->currentDir->inode->data.parent == inode->sector){
     goto done;
   }
-  /* Remove inode. */
+  /* Remove inode.  A directory is marked removed under its own
+     directory lock, so that dir_add() cannot add an entry to it
+     afterward. */
+  rwlock_acquire_write (&inode->dir_lock);
   inode_remove (inode);
+  rwlock_release_write (&inode->dir_lock);
   success = true;
 
  done:
+  rwlock_release_write (&dir->inode->dir_lock);
   inode_close (inode);
   return success;
 }
 
+/* Reads up to CNT more entries from DIR and stores their names
+   in NAMES.  Returns the number of names stored, which is less
+   than CNT only if the directory contains no more entries.
+   DIR's position counts slots across the buckets in order, so
+   entries that move when a bucket is split may be skipped or
+   returned twice. */
+int
+dir_readdir_multi (struct dir *dir, char names[][NAME_MAX + 1], int cnt)
+{
+  struct dir_bucket *bucket;
+  int n = 0;
+
+  if (cnt <= 0)
+    return 0;
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return 0;
+
+  rwlock_acquire_read (&dir->inode->dir_lock);
+  while (n < cnt
+         && read_bucket (dir->inode, dir->pos / BUCKET_ENTRIES + 1, bucket))
+    {
+      int slot;
+
+      for (slot = dir->pos % BUCKET_ENTRIES;
+           slot < BUCKET_ENTRIES && n < cnt; slot++)
+        {
+          struct dir_entry *e = &bucket->entries[slot];
+
+          dir->pos++;
+          if (e->in_use && e->name[0] != '.')
+            strlcpy (names[n++], e->name, NAME_MAX + 1);
+        }
+    }
+  rwlock_release_read (&dir->inode->dir_lock);
+
+  free (bucket);
+  return n;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
-
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
-    {
-      dir->pos += sizeof e;
-      if (e.in_use && e.name[0] != '.')
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
-    }
-  return false;
+  return dir_readdir_multi (dir, (char (*)[NAME_MAX + 1]) name, 1) == 1;
 }
@@ -34,5 +34,6 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+int dir_readdir_multi (struct dir *, char names[][NAME_MAX + 1], int cnt);
 
 #endif /* filesys/directory.h */
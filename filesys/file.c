@@ -3,7 +3,8 @@
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
-/* An open file. */
+/* Most sectors to read ahead of a sequential reader. */
+#define READ_AHEAD_MAX 8
 
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -18,6 +19,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -64,7 +67,21 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+
+  /* A read that starts where the previous one ended looks like
+     a sequential scan, so ask for the sectors after it to be
+     fetched in the background.  The window doubles with each
+     sequential read, up to READ_AHEAD_MAX, and collapses on the
+     first read that is not sequential. */
+  if (file->pos != file->ra_next)
+    file->ra_window = 0;
+  else if (file->ra_window < READ_AHEAD_MAX)
+    file->ra_window = file->ra_window == 0 ? 1 : file->ra_window * 2;
   file->pos += bytes_read;
+  file->ra_next = file->pos;
+  if (file->ra_window > 0 && bytes_read > 0)
+    inode_read_ahead (file->inode, file->pos, file->ra_window);
+
   return bytes_read;
 }
 
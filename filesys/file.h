@@ -11,6 +11,8 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a sequential read would start. */
+    int ra_window;              /* Sectors to read ahead, 0 if random. */
   };
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
@@ -2,9 +2,12 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
@@ -12,6 +15,17 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Journal slots reserved by filesys_create(): the new inode, the
+   new directory's header and first bucket, and, in the parent
+   directory, its inode, extent tree index and last two leaves,
+   header, the bucket the name hashes to, and up to DIR_MAX_DEPTH
+   buckets split off it plus an overflow bucket. */
+#define CREATE_SLOTS 17
+
+/* Journal slots reserved by filesys_remove(): the bucket that
+   held the entry and the directory header's entry count. */
+#define REMOVE_SLOTS 2
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -23,12 +37,18 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  journal_init ();
+  cache_init ();
+  dcache_init ();
   inode_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
+  /* Finish any transaction interrupted by a crash before reading
+     the free map, which it may have changed. */
+  journal_open ();
   free_map_open ();
    //   thread_current()->currentDir=dir_open_root();
 }
@@ -38,9 +58,103 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  /* Commit the last journal transaction, then close the free
+     map, which has nothing left to write, and write back whatever
+     else remains in sector order. */
+  journal_close ();
   free_map_close ();
+  cache_flush ();
 }
 
+/* Replaces *DIR, which the caller must have open, by its
+   subdirectory NAME.  "." is *DIR itself, and ".." in the root
+   directory is the root.  Returns false, leaving *DIR open, if
+   NAME does not exist or is not a directory. */
+static bool
+enter_dir (struct dir **dir, const char *name)
+{
+  struct inode *inode;
+  struct dir *next;
+
+  if (!strcmp (name, ".")
+      || (!strcmp (name, "..")
+          && inode_get_inumber (dir_get_inode (*dir)) == ROOT_DIR_SECTOR))
+    return true;
+
+  if (!dir_lookup (*dir, name, &inode))
+    return false;
+  if (!inode->isdir)
+    {
+      inode_close (inode);
+      return false;
+    }
+  next = dir_open (inode);
+  if (next == NULL)
+    return false;
+  dir_close (*dir);
+  *dir = next;
+  return true;
+}
+
+/* Resolves every component of path NAME but the last.  NAME is
+   relative to the current thread's working directory unless it
+   starts with '/'.  Empty components are ignored, so "a//b/" is
+   the same as "a/b".
+   On success, copies the last component into LAST, or the empty
+   string if NAME names the root, and returns the directory that
+   should contain it, which the caller must close.  Returns a null
+   pointer if NAME is empty, a component is too long, or a
+   directory along the way does not exist. */
+static struct dir *
+resolve_path (const char *name, char last[NAME_MAX + 1])
+{
+  struct thread *t = thread_current ();
+  struct dir *dir;
+
+  if (*name == '\0')
+    return NULL;
+  if (*name == '/' || t->currentDir == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (t->currentDir);
+  if (dir == NULL)
+    return NULL;
+
+  for (;;)
+    {
+      const char *end;
+      size_t len;
+
+      while (*name == '/')
+        name++;
+      for (end = name; *end != '\0' && *end != '/'; end++)
+        continue;
+      len = end - name;
+      if (len > NAME_MAX)
+        break;
+      memcpy (last, name, len);
+      last[len] = '\0';
+
+      for (name = end; *name == '/'; name++)
+        continue;
+      if (*name == '\0')
+        return dir;
+      if (!enter_dir (&dir, last))
+        break;
+    }
+
+  dir_close (dir);
+  return NULL;
+}
+
+/* Returns true if NAME, the last component of a path, can name a
+   new or existing entry rather than a directory itself. */
+static bool
+is_entry_name (const char *name)
+{
+  return *name != '\0' && strcmp (name, ".") && strcmp (name, "..");
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -49,81 +163,38 @@ bool
 filesys_create (const char *name, off_t initial_size, bool isDir) 
 {
   block_sector_t inode_sector = 0;
-  //look for directory for the file//
-  int i=0;
-  if(name[i]==NULL){return false;}
-  //moving a directory that is inside our current directory//
-  struct thread* t= thread_current();
-  struct dir* currentDir=NULL;
-
-  if(name[i]!='/' && t->currentDir!=NULL){
-      currentDir=t->currentDir;
-  }
-  else if(name[i]=='/'){
-    currentDir=dir_open_root();
-    i++;
-    if(name[i]==NULL){
-      dir_close (currentDir);
-      return false;
-    }
-  }
-  //moving to the root first and then look for directory//
-  else {
-    currentDir=dir_open_root();
-  }
-  //char* file =(char*)malloc(sizeof(char)*strlen(name));
-  char file[strlen(name)+1];
-  struct inode* currentInode;
-  int k=0;
-  bool finalDir=false;
-  while(name[i]!=NULL){
-    if(name[i]=='.' && name[i+1]=='.'){
-        i=i+2;
-        file[0]='.';
-        file[1]='.';
-        dir_lookup (currentDir, file,&currentInode);
-        if(currentInode==NULL){return false;}
-        currentDir=dir_open(currentInode);
-        if(currentDir==NULL){return false;}
-
-    }
-    else if (name[i]=='/'){
-        file[k]=0;
-        dir_lookup (currentDir, file,&currentInode);
-        if(currentInode==NULL){return false;}
-        currentDir=dir_open(currentInode);
-        if(currentDir==NULL){return false;}
-        k=0;
-        finalDir=false;
-      i++;
-    }
-    else{
-      file[k]=name[i];
-      i++;
-      k++;
-    }
-
-  }
-  file[k]=0;
+  char file[NAME_MAX + 1];
+  struct dir *currentDir;
+  bool success;
 
+  journal_begin (CREATE_SLOTS);
+  currentDir = resolve_path (name, file);
 
-  bool success = (currentDir != NULL && !currentDir->inode->removed
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size,isDir)
-                  && dir_add (currentDir, file, inode_sector));
+  /* Put a file's inode near its directory's, so that they can be
+     read together, but start a new directory in the emptiest
+     part of the disk, to leave room for its files. */
+  success = (currentDir != NULL && is_entry_name (file)
+             && !currentDir->inode->removed
+             && free_map_allocate_near (isDir ? free_map_spread_goal ()
+                                        : currentDir->inode->sector,
+                                        1, &inode_sector)
+             && (isDir ? dir_create (inode_sector, 0)
+                 : inode_create (inode_sector, initial_size, false))
+             && dir_add (currentDir, file, inode_sector));
   if(isDir && success){
     struct inode* inode = inode_open(inode_sector);
     struct dir* dir = dir_open(inode);
     dir_add(dir, ".", inode_sector);
     dir_add(dir, "..", currentDir->inode->sector);
+    dir_close (dir);
   }
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
-  //dir_close (currentDir);
-  int dummy=0;
-  //free(file);
+  dir_close (currentDir);
+  journal_end ();
   return success;
 }
+
 /* Opens the file with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
@@ -132,77 +203,42 @@ filesys_create (const char *name, off_t initial_size, bool isDir)
 struct file *
 filesys_open (const char *name)
 {
-
-  int i=0;
-  if(name[i]==NULL){return false;}
-  //moving a directory that is inside our current directory//
-  struct thread* t= thread_current();
-  struct dir* currentDir=NULL;
-  if(name[i]!='/' && t->currentDir!=NULL){
-      currentDir=t->currentDir;
-  }
-  else if(name[i]=='/'){
-    currentDir=dir_open_root();
-    i++;
-        if(name[i]==NULL){
-      return (struct file*)currentDir;
-    }
-  }
-  //moving to the root first and then look for directory//
-  else {
-    currentDir=dir_open_root();
-  }
-  //char* file =(char*)calloc(1, sizeof(char)*strlen(name));
-  char file[strlen(name)+1];
-  struct inode* currentInode;
-  int k=0;
-  bool finalDir=false;
-  while(name[i]!=NULL){
-    if(name[i]=='.' && name[i+1]=='.'){
-        i=i+2;
-        file[0]='.';
-        file[1]='.';
-        dir_lookup (currentDir, file,&currentInode);
-        if(currentInode==NULL){
-         // free(file);
-          return false;}
-        currentDir=dir_open(currentInode);
-        if(currentDir==NULL){
-           //free(file);
-          return false;}
-
-    }
-    else if (name[i]=='/'){
-        file[k]=0;
-        dir_lookup (currentDir, file,&currentInode);
-        if(currentInode==NULL){
-          // free(file);
-          return false;}
-        currentDir=dir_open(currentInode);
-        if(currentDir==NULL){
-           //free(file);
-          return false;}
-        k=0;
-        finalDir=false;
-      i++;
-    }
-    else{
-      file[k]=name[i];
-      i++;
-      k++;
-    }
-
-  }
-  file[k]=0;
+  char file[NAME_MAX + 1];
+  struct dir *currentDir = resolve_path (name, file);
   struct inode *inode = NULL;
 
-  if (currentDir != NULL)
+  if (currentDir == NULL)
+    return NULL;
+  if (is_entry_name (file))
     dir_lookup (currentDir, file, &inode);
-  //dir_close (currentDir);
- // free(file);
+  else if (*file == '\0' || enter_dir (&currentDir, file))
+    {
+      /* NAME is a directory itself, such as "/" or "..".  Hand
+         back a real struct file, as for any other directory,
+         since struct file has fields that struct dir lacks. */
+      inode = inode_reopen (dir_get_inode (currentDir));
+    }
+  dir_close (currentDir);
   return file_open (inode);
 }
 
+/* Opens the directory named NAME, for use as a working
+   directory.  Returns a null pointer if it does not exist or is
+   not a directory. */
+struct dir *
+filesys_open_dir (const char *name)
+{
+  char file[NAME_MAX + 1];
+  struct dir *dir = resolve_path (name, file);
+
+  if (dir != NULL && *file != '\0' && !enter_dir (&dir, file))
+    {
+      dir_close (dir);
+      dir = NULL;
+    }
+  return dir;
+}
+
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
@@ -210,76 +246,25 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  int i=0;
-  if(name[i]==NULL){return false;}
-  //moving a directory that is inside our current directory//
-  struct thread* t= thread_current();
-  struct dir* currentDir=NULL;
-  if(name[i]!='/' && t->currentDir!=NULL){
-      currentDir=t->currentDir;
-  }
-  else if(name[i]=='/'){
-    currentDir=dir_open_root();
-    i++;
-          if(name[i]==NULL){
-      dir_close (currentDir);
-      return false;
-    }
-  }
-  //moving to the root first and then look for directory//
-  else {
-    currentDir=dir_open_root();
-  }
-  char* file =(char*)malloc(sizeof(char)*strlen(name));
-  struct inode* currentInode;
-  int k=0;
-  bool finalDir=false;
-  while(name[i]!=NULL){
-    if(name[i]=='.' && name[i+1]=='.'){
-        i=i+2;
-        file[0]='.';
-        file[1]='.';
-        dir_lookup (currentDir, file,&currentInode);
-        if(currentInode==NULL){return false;}
-        currentDir=dir_open(currentInode);
-        if(currentDir==NULL){return false;}
+  char file[NAME_MAX + 1];
+  struct dir *currentDir;
+  bool success;
 
-    }
-    else if (name[i]=='/'){
-        file[k]=0;
-        dir_lookup (currentDir, file,&currentInode);
-        if(currentInode==NULL){return false;}
-        currentDir=dir_open(currentInode);
-        if(currentDir==NULL){return false;}
-        k=0;
-        finalDir=false;
-      i++;
-    }
-    else{
-      file[k]=name[i];
-      i++;
-      k++;
-    }
-
-  }
-  file[k]=0;
-
-  //had to remove this check to pass tests
-  //not removing cwd here so not relevant
-  //still need those checks somewhere though, just don't know where yet
-  //can only remove dir if it is empty
-    bool success = currentDir != NULL && dir_remove (currentDir, file);
-    free(file);
-    //dir_close (currentDir); 
-    return success;
-  //}
-  //return false;
+  journal_begin (REMOVE_SLOTS);
+  currentDir = resolve_path (name, file);
+  success = (currentDir != NULL && is_entry_name (file)
+             && dir_remove (currentDir, file));
+  dir_close (currentDir);
+  journal_end ();
+  return success;
 }
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  journal_create ();
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
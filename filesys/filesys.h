@@ -7,6 +7,9 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal. */
+
+struct dir;
 
 /* Block device that contains the file system. */
 struct block *fs_device;
@@ -15,6 +18,7 @@ void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size,bool isDir);
 struct file *filesys_open (const char *name);
+struct dir *filesys_open_dir (const char *name);
 bool filesys_remove (const char *name);
 
 #endif /* filesys/filesys.h */
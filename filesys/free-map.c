@@ -1,76 +1,459 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Number of free map bits stored in one sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file whose bits have changed since
+   they were last written, one bit per free map file sector.
+   Changes are written only by free_map_sync(), so allocating a
+   run of sectors costs a few bit operations instead of a write
+   of the whole free map. */
+static struct bitmap *free_map_dirty;
+
+/* The sector that holds each sector of the free map file, so
+   that free_map_collect() can log changed free map sectors
+   without going through the file.  Set when the file is opened
+   or created, which writes all of it, so that it has no holes
+   and never grows. */
+static block_sector_t *free_map_homes;
+
+/* Sectors released while the journal is active, one bit per
+   sector.  They stay in use until the journal transaction that
+   released them has committed, since until then a crash rolls the
+   metadata back to a state that may still point to them, and
+   reusing them could overwrite what it points to.  A bitmap
+   rather than a list, so that releasing never runs out of
+   memory. */
+static struct bitmap *free_map_freed;
+static size_t freed_cnt;                /* Bits set in free_map_freed. */
+
+/* Allocation groups.
+
+   The disk is divided into groups of GROUP_SECTORS consecutive
+   sectors, each with its bits in a single sector of the free map
+   file.  A file's inode is allocated near its directory's and its
+   data near its inode, so that a file and its neighbors stay
+   together, while new directories start out in the group with
+   the most free space, so that the disk fills evenly.  Allocation
+   searches skip over groups that are full. */
+#define GROUP_SECTORS BITS_PER_SECTOR
+static size_t group_cnt;                /* Number of groups. */
+static size_t *group_free;              /* Free sectors in each group. */
+
+/* Where free_map_allocate() starts looking, just past the last
+   run it allocated, so that it does not rescan the full groups
+   at the front of the disk every time. */
+static size_t next_fit;
+
+/* Protects free_map, free_map_dirty, free_map_freed, freed_cnt,
+   group_free, and next_fit.
+   Files acquire it while holding their inode's lock, to allocate
+   sectors.  The free map file's own inode lock is acquired while
+   holding it, to sync, which is safe because free_map_create()
+   writes the whole file once, so that syncing never allocates. */
+static struct lock free_map_lock;
+
+/* Returns the number of sectors in group G. */
+static size_t
+group_size (size_t g)
+{
+  size_t start = g * GROUP_SECTORS;
+  size_t left = bitmap_size (free_map) - start;
+  return left < GROUP_SECTORS ? left : GROUP_SECTORS;
+}
+
+/* Counts the free sectors in each group. */
+static void
+count_groups (void)
+{
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    group_free[g] = bitmap_count (free_map, g * GROUP_SECTORS,
+                                  group_size (g), false);
+}
+
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                                BITS_PER_SECTOR));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  free_map_homes = malloc (bitmap_size (free_map_dirty)
+                           * sizeof *free_map_homes);
+  if (free_map_homes == NULL)
+    PANIC ("free map creation failed");
+  free_map_freed = bitmap_create (bitmap_size (free_map));
+  if (free_map_freed == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  freed_cnt = 0;
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("allocation group creation failed");
+  count_groups ();
+  next_fit = 0;
+  lock_init (&free_map_lock);
+}
+
+/* Marks the CNT sectors starting at SECTOR as in use if USED is
+   true, or as free otherwise, and records that the free map bits
+   for them have changed.  The sectors must all be in the other
+   state.  The caller must hold free_map_lock. */
+static void
+mark (block_sector_t sector, size_t cnt, bool used)
+{
+  size_t end = sector + cnt;
+  size_t pos;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  ASSERT (used ? bitmap_none (free_map, sector, cnt)
+          : bitmap_all (free_map, sector, cnt));
+
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  for (pos = sector; pos < end; )
+    {
+      size_t g = pos / GROUP_SECTORS;
+      size_t group_end = (g + 1) * GROUP_SECTORS;
+      size_t n = (end < group_end ? end : group_end) - pos;
+
+      if (used)
+        group_free[g] -= n;
+      else
+        group_free[g] += n;
+      bitmap_mark (free_map_dirty, g);
+      pos += n;
+    }
+}
+
+/* Returns the first sector of a run of CNT free sectors, looking
+   first at GOAL and after, then wrapping around to the start of
+   the disk, or BITMAP_ERROR if there is no such run.  Groups that
+   are full are skipped without looking at their bits.  The
+   caller must hold free_map_lock. */
+static size_t
+find_run (size_t goal, size_t cnt)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  bool wrapped = false;
+  size_t pos;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  if (cnt == 0 || cnt > bit_cnt)
+    return BITMAP_ERROR;
+  if (goal >= bit_cnt)
+    goal = 0;
+  pos = goal;
+  for (;;)
+    {
+      size_t g = pos / GROUP_SECTORS;
+
+      if (group_free[g] == 0)
+        pos = (g + 1) * GROUP_SECTORS;
+      else
+        {
+          /* Search to the end of the disk at most, since a run
+             may cross into the following groups. */
+          size_t sector = bitmap_scan (free_map, pos, cnt, false);
+          if (sector != BITMAP_ERROR)
+            return sector;
+          pos = bit_cnt;
+        }
+
+      if (pos >= bit_cnt)
+        {
+          if (wrapped || goal == 0)
+            return BITMAP_ERROR;
+          wrapped = true;
+          pos = 0;
+        }
+      else if (wrapped && pos >= goal)
+        return BITMAP_ERROR;
+    }
+}
+
+/* Allocates CNT consecutive sectors, preferring ones at or after
+   GOAL, and stores the first into *SECTORP.  Returns true if
+   successful, false if not enough consecutive sectors were
+   available. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  size_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = find_run (goal, cnt);
+  if (sector != BITMAP_ERROR)
+    mark (sector, cnt, true);
+  lock_release (&free_map_lock);
+
+  if (sector != BITMAP_ERROR)
+    *sectorp = sector;
+  return sector != BITMAP_ERROR;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The search starts where the last one
+   left off.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = find_run (next_fit, cnt);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark (sector, cnt, true);
+      next_fit = sector + cnt;
     }
+  lock_release (&free_map_lock);
+
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Returns the first sector of the allocation group with the most
+   free sectors, as a goal for free_map_allocate_near() when
+   placing something, such as a new directory, that should start
+   out away from existing files. */
+block_sector_t
+free_map_spread_goal (void)
+{
+  size_t best = 0;
+  size_t g;
+
+  lock_acquire (&free_map_lock);
+  for (g = 1; g < group_cnt; g++)
+    if (group_free[g] > group_free[best])
+      best = g;
+  lock_release (&free_map_lock);
+
+  return best * GROUP_SECTORS;
+}
+
+/* Allocates up to CNT sectors starting exactly at SECTOR, stopping
+   at the first sector that is already in use, and returns the
+   number allocated.  Used to grow a run of sectors in place. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  size_t got = 0;
+
+  lock_acquire (&free_map_lock);
+  if (sector < bitmap_size (free_map))
+    {
+      if (cnt > bitmap_size (free_map) - sector)
+        cnt = bitmap_size (free_map) - sector;
+      while (got < cnt && !bitmap_test (free_map, sector + got))
+        got++;
+      mark (sector, got, true);
+    }
+  lock_release (&free_map_lock);
+
+  return got;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.  While
+   the journal is active, they become available only once the
+   running transaction has committed; see
+   free_map_release_deferred(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  lock_acquire (&free_map_lock);
+  if (journal_is_active ())
+    {
+      ASSERT (bitmap_all (free_map, sector, cnt));
+      ASSERT (bitmap_none (free_map_freed, sector, cnt));
+      bitmap_set_multiple (free_map_freed, sector, cnt, true);
+      freed_cnt += cnt;
+    }
+  else
+    mark (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released while the journal was active
+   available for use.  Called by the journal once the transaction
+   that released them has committed.  The free map sectors that
+   change are written by the next transaction; a crash before
+   then leaves the sectors marked in use but unused, which wastes
+   them but points nothing at anything else's data. */
+void
+free_map_release_deferred (void)
+{
+  size_t start = 0;
+
+  lock_acquire (&free_map_lock);
+  while (freed_cnt > 0)
+    {
+      size_t end;
+
+      start = bitmap_scan (free_map_freed, start, 1, true);
+      ASSERT (start != BITMAP_ERROR);
+      end = bitmap_scan (free_map_freed, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (free_map_freed);
+      bitmap_set_multiple (free_map_freed, start, end - start, false);
+      mark (start, end - start, false);
+      freed_cnt -= end - start;
+      start = end;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Returns the number of sectors in the free map file, which is
+   the most that free_map_sync() can write or free_map_collect()
+   can return. */
+size_t
+free_map_file_sectors (void)
+{
+  return bitmap_size (free_map_dirty);
+}
+
+/* Writes the free map sectors that have changed since the last
+   sync to the free map file.  The caller must hold
+   free_map_lock. */
+static void
+sync_locked (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  if (free_map_file == NULL)
+    return;
+  for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    if (bitmap_test (free_map_dirty, i))
+      {
+        size_t start = i * BITS_PER_SECTOR;
+        size_t cnt = bit_cnt - start < BITS_PER_SECTOR
+                     ? bit_cnt - start : BITS_PER_SECTOR;
+        if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+          PANIC ("can't write free map");
+        bitmap_reset (free_map_dirty, i);
+      }
+}
+
+/* Writes the free map sectors that have changed since the last
+   sync to the free map file. */
+void
+free_map_sync (void)
+{
+  lock_acquire (&free_map_lock);
+  sync_locked ();
+  lock_release (&free_map_lock);
+}
+
+/* Copies the free map sectors that have changed since the last
+   sync or collection into DATA, up to CNT sectors of
+   BLOCK_SECTOR_SIZE bytes each, and the sectors that they belong
+   in into SECTORS, and returns how many there were.  Afterward
+   they count as written, so the caller must write them.  Used by
+   the journal to log the free map without holding its sectors in
+   the buffer cache. */
+size_t
+free_map_collect (block_sector_t sectors[], uint8_t *data, size_t cnt)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t n = 0;
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (free_map_dirty); i++)
+      if (bitmap_test (free_map_dirty, i))
+        {
+          size_t start = i * BITS_PER_SECTOR;
+          size_t bits = bit_cnt - start < BITS_PER_SECTOR
+                        ? bit_cnt - start : BITS_PER_SECTOR;
+          uint8_t *sector_data = data + n * BLOCK_SECTOR_SIZE;
+
+          ASSERT (n < cnt);
+          memset (sector_data, 0, BLOCK_SECTOR_SIZE);
+          bitmap_copy_range (free_map, start, bits, sector_data);
+          sectors[n++] = free_map_homes[i];
+          bitmap_reset (free_map_dirty, i);
+        }
+  lock_release (&free_map_lock);
+  return n;
+}
+
+/* Records the sector that holds each sector of the free map
+   file. */
+static void
+find_homes (void)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    {
+      free_map_homes[i] = inode_get_sector (file_get_inode (free_map_file),
+                                            i * BLOCK_SECTOR_SIZE);
+      ASSERT (free_map_homes[i] != FREE_MAP_SECTOR
+              && free_map_homes[i] != (block_sector_t) -1);
+    }
 }
 
 /* Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
+  find_homes ();
+  count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
+  lock_acquire (&free_map_lock);
+  sync_locked ();
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map),false))
@@ -82,4 +465,6 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
+  find_homes ();
 }
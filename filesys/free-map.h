@@ -10,8 +10,16 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_sync (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t goal, size_t,
+                             block_sector_t *);
+block_sector_t free_map_spread_goal (void);
+size_t free_map_allocate_at (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_deferred (void);
+size_t free_map_file_sectors (void);
+size_t free_map_collect (block_sector_t[], uint8_t *, size_t cnt);
 
 #endif /* filesys/free-map.h */
@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,10 @@
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
+/* Number of sectors moved between the scratch device and a file
+   at a time by `extract' and `append'. */
+#define COPY_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
 /* List files in the root directory. */
 void
 fsutil_ls (char **argv UNUSED) 
@@ -79,7 +84,7 @@ fsutil_extract (char **argv UNUSED)
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = malloc (COPY_SECTORS * BLOCK_SECTOR_SIZE);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -127,10 +132,16 @@ fsutil_extract (char **argv UNUSED)
           /* Do copy. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
+              size_t sectors = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+              int chunk_size;
+
+              if (sectors > COPY_SECTORS)
+                sectors = COPY_SECTORS;
+              chunk_size = (size > (int) (sectors * BLOCK_SECTOR_SIZE)
+                            ? (int) (sectors * BLOCK_SECTOR_SIZE)
+                            : size);
+              block_read_multiple (src, sector, data, sectors);
+              sector += sectors;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -177,7 +188,7 @@ fsutil_append (char **argv)
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
   /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
+  buffer = malloc (COPY_SECTORS * BLOCK_SECTOR_SIZE);
   if (buffer == NULL)
     PANIC ("couldn't allocate buffer");
 
@@ -200,13 +211,22 @@ fsutil_append (char **argv)
   /* Do copy. */
   while (size > 0) 
     {
-      int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-      if (sector >= block_size (dst))
+      size_t sectors = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+      int chunk_size;
+
+      if (sectors > COPY_SECTORS)
+        sectors = COPY_SECTORS;
+      chunk_size = (size > (off_t) (sectors * BLOCK_SECTOR_SIZE)
+                    ? (int) (sectors * BLOCK_SECTOR_SIZE)
+                    : size);
+      if (sectors > block_size (dst) - sector)
         PANIC ("%s: out of space on scratch device", file_name);
       if (file_read (src, buffer, chunk_size) != chunk_size)
         PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-      block_write (dst, sector++, buffer);
+      memset (buffer + chunk_size, 0,
+              sectors * BLOCK_SECTOR_SIZE - chunk_size);
+      block_write_multiple (dst, sector, buffer, sectors);
+      sector += sectors;
       size -= chunk_size;
     }
 
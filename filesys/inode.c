@@ -3,62 +3,33 @@
 #include <round.h>
 #include <string.h>
 #include "threads/synch.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
- //indirect_index points to one of these which points to data blocks
- //double_indirect_index points to one of these which points to 128 more of them which each point to data blocks
- struct inode_indirect_block_sector {
-   block_sector_t blocks[INDIRECT_BLOCKS_PER_SECTOR];
- };
-
-//converts an index to a sector number (index created from file pos / BLOCK_SECTOR_SIZE)
-block_sector_t index_to_sector (const struct inode_disk *idisk, off_t index) {
-   int index_base = 0;
-   block_sector_t ret;
-
-   if (index < index_base) return -1;
-    // direct blocks
-   if (index < DIRECT_BLOCKS_COUNT) {
-     return idisk->direct_blocks[index];
-   }
-   index_base += DIRECT_BLOCKS_COUNT;
- 
-   // indirect block
-   if (index < index_base + INDIRECT_BLOCKS_PER_SECTOR) {
-    //calloc initializes it to all 0's
-     struct inode_indirect_block_sector* indirect_idisk = calloc(1, sizeof(struct inode_indirect_block_sector));
-     block_read (fs_device, idisk->indirect_block, indirect_idisk);
- 
-     ret = indirect_idisk->blocks[ index - index_base ];
-     free(indirect_idisk); 
- 
-     return ret;
-   }
-   index_base += INDIRECT_BLOCKS_PER_SECTOR;
- 
-   // doubly indirect block
-   if (index < index_base + INDIRECT_BLOCKS_PER_SECTOR * INDIRECT_BLOCKS_PER_SECTOR) {
-     off_t index_first =  (index - index_base) / INDIRECT_BLOCKS_PER_SECTOR;  //how far to index into first indirect_block_sector
-     off_t index_second = (index - index_base) % INDIRECT_BLOCKS_PER_SECTOR;  //how far to index into second indirect_block_sector
-
-     struct inode_indirect_block_sector *indirect_idisk = calloc(1, sizeof(struct inode_indirect_block_sector));
-
-     block_read (fs_device, idisk->doubly_indirect_block, indirect_idisk);
-     block_read (fs_device, indirect_idisk->blocks[index_first], indirect_idisk);
-     ret = indirect_idisk->blocks[index_second];
- 
-     free(indirect_idisk);
-     return ret;
-   }
-   //invalid, over ~8MB big
-   return -1;
- }
+/* Most extents an inode can have, if every leaf of its extent
+   tree is full. */
+#define MAX_EXTENTS (INODE_EXTENTS + INDEX_LEAVES * LEAF_EXTENTS)
+
+/* Most sectors allocated beyond what a write needs when a write
+   at the end of a file has to allocate sectors.  A file grown a
+   little at a time thus gets extents of increasing size, up to
+   this limit, instead of one per write. */
+#define PREALLOC_MAX 64
+
+/* An extent that starts at sector HOLE is a hole: no sectors are
+   allocated for it, and it reads as zeros.  Sector 0 holds the
+   free map's inode, so it is never file data. */
+#define HOLE FREE_MAP_SECTOR
+
+/* A sector's worth of zeros, for initializing new sectors. */
+static char zeros[BLOCK_SECTOR_SIZE];
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -68,164 +39,946 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Returns true if INODE's data is metadata, as the data in
+   directories and the free map is, so that it goes into the
+   journal; other inodes' data does not. */
+static bool
+holds_metadata (const struct inode *inode)
+{
+  return inode->isdir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, which holds data
+   for INODE, starting at byte OFFSET within the sector. */
+static void
+write_data (const struct inode *inode, block_sector_t sector,
+            const void *buffer, off_t size, off_t offset)
+{
+  if (holds_metadata (inode))
+    cache_write_meta_at (sector, buffer, size, offset);
+  else
+    cache_write_at (sector, buffer, size, offset);
+}
+
+/* Returns the number of leaves in use in an extent tree for an
+   inode whose EXTENT_CNT is CNT. */
+static size_t
+tree_leaves (size_t cnt)
+{
+  return cnt > INODE_EXTENTS ? DIV_ROUND_UP (cnt - INODE_EXTENTS,
+                                             LEAF_EXTENTS) : 0;
+}
+
+/* Returns true if extent IDX is the first one in a leaf of the
+   extent tree. */
+static bool
+starts_leaf (size_t idx)
+{
+  return idx >= INODE_EXTENTS && (idx - INODE_EXTENTS) % LEAF_EXTENTS == 0;
+}
+
+/* Returns the position of the first extent in leaf LEAF of an
+   extent tree. */
+static size_t
+leaf_start (size_t leaf)
+{
+  return INODE_EXTENTS + leaf * LEAF_EXTENTS;
+}
+
+/* Stores entry LEAF of IDISK's extent tree index into *L. */
+static void
+get_leaf (const struct inode_disk *idisk, size_t leaf, struct extent_leaf *l)
+{
+  ASSERT (leaf < INDEX_LEAVES);
+  cache_read_at (idisk->index, l, sizeof *l, leaf * sizeof *l);
+}
+
+/* Sets entry LEAF of IDISK's extent tree index to L. */
+static void
+set_leaf (struct inode_disk *idisk, size_t leaf, const struct extent_leaf *l)
+{
+  ASSERT (leaf < INDEX_LEAVES);
+  cache_write_meta_at (idisk->index, l, sizeof *l, leaf * sizeof *l);
+}
+
+/* Adds DELTA to the length of the leaf that holds extent IDX of
+   IDISK, if IDX is in the extent tree. */
+static void
+add_leaf_length (struct inode_disk *idisk, size_t idx, block_sector_t delta)
+{
+  if (idx >= INODE_EXTENTS)
+    {
+      size_t leaf = (idx - INODE_EXTENTS) / LEAF_EXTENTS;
+      struct extent_leaf l;
+
+      get_leaf (idisk, leaf, &l);
+      l.length += delta;
+      set_leaf (idisk, leaf, &l);
+    }
+}
+
+/* Stores slot SLOT of the extent tree leaf in SECTOR into *E. */
+static void
+get_slot (block_sector_t sector, size_t slot, struct extent *e)
+{
+  ASSERT (slot < LEAF_EXTENTS);
+  cache_read_at (sector, e, sizeof *e, slot * sizeof *e);
+}
+
+/* Sets slot SLOT of the extent tree leaf in SECTOR to E. */
+static void
+put_slot (block_sector_t sector, size_t slot, const struct extent *e)
+{
+  ASSERT (slot < LEAF_EXTENTS);
+  cache_write_meta_at (sector, e, sizeof *e, slot * sizeof *e);
+}
+
+/* Returns the number of extents in leaf LEAF of IDISK's extent
+   tree.  A leaf's extents are packed at its start, so this takes
+   a binary search for its first empty slot. */
+static size_t
+leaf_used (const struct inode_disk *idisk, size_t leaf)
+{
+  size_t lo = 0, hi = LEAF_EXTENTS;
+  struct extent_leaf l;
+
+  get_leaf (idisk, leaf, &l);
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      struct extent e;
+
+      get_slot (l.sector, mid, &e);
+      if (e.length != 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Puts E into slot SLOT of leaf LEAF of IDISK's extent tree,
+   which holds USED extents, moving the extents from SLOT on up
+   by one. */
+static void
+leaf_insert (struct inode_disk *idisk, size_t leaf, size_t used,
+             size_t slot, const struct extent *e)
+{
+  struct extent_leaf l;
+  size_t i;
+
+  ASSERT (used < LEAF_EXTENTS);
+  ASSERT (slot <= used);
+  get_leaf (idisk, leaf, &l);
+  for (i = used; i > slot; i--)
+    {
+      struct extent moved;
+
+      get_slot (l.sector, i - 1, &moved);
+      put_slot (l.sector, i, &moved);
+    }
+  put_slot (l.sector, slot, e);
+  l.length += e->length;
+  set_leaf (idisk, leaf, &l);
+}
+
+/* Takes the extent in slot SLOT out of leaf LEAF of IDISK's
+   extent tree, which holds USED extents, and stores it into *E,
+   moving the extents after it down by one. */
+static void
+leaf_remove (struct inode_disk *idisk, size_t leaf, size_t used,
+             size_t slot, struct extent *e)
+{
+  static const struct extent empty;
+  struct extent_leaf l;
+  size_t i;
+
+  ASSERT (slot < used);
+  get_leaf (idisk, leaf, &l);
+  get_slot (l.sector, slot, e);
+  for (i = slot + 1; i < used; i++)
+    {
+      struct extent moved;
+
+      get_slot (l.sector, i, &moved);
+      put_slot (l.sector, i - 1, &moved);
+    }
+  put_slot (l.sector, used - 1, &empty);
+  l.length -= e->length;
+  set_leaf (idisk, leaf, &l);
+}
+
+/* Stores extent IDX of IDISK into *E.  An empty slot in the
+   extent tree reads as an extent of length 0. */
+static void
+get_extent (const struct inode_disk *idisk, size_t idx, struct extent *e)
+{
+  ASSERT (idx < idisk->extent_cnt);
+  if (idx < INODE_EXTENTS)
+    *e = idisk->extents[idx];
+  else
+    {
+      size_t t = idx - INODE_EXTENTS;
+      struct extent_leaf l;
+
+      get_leaf (idisk, t / LEAF_EXTENTS, &l);
+      get_slot (l.sector, t % LEAF_EXTENTS, e);
+    }
+}
+
+/* Stores E as extent IDX of IDISK, without updating the length
+   of the leaf that holds it. */
+static void
+put_extent (struct inode_disk *idisk, size_t idx, const struct extent *e)
+{
+  ASSERT (idx < idisk->extent_cnt);
+  if (idx < INODE_EXTENTS)
+    idisk->extents[idx] = *e;
+  else
+    {
+      size_t t = idx - INODE_EXTENTS;
+      struct extent_leaf l;
+
+      get_leaf (idisk, t / LEAF_EXTENTS, &l);
+      put_slot (l.sector, t % LEAF_EXTENTS, e);
+    }
+}
+
+/* Sets extent IDX of IDISK to E.  Extents in the tree are
+   written through the cache; the rest only change IDISK, which
+   the caller must write back itself. */
+static void
+set_extent (struct inode_disk *idisk, size_t idx, const struct extent *e)
+{
+  struct extent old;
+
+  get_extent (idisk, idx, &old);
+  put_extent (idisk, idx, e);
+  add_leaf_length (idisk, idx, e->length - old.length);
+}
+
+/* Returns the number of data sectors that IDISK's extents
+   cover.  Reads only the index of the extent tree, not its
+   leaves. */
+static size_t
+covered_sectors (const struct inode_disk *idisk)
+{
+  size_t total = 0;
+  size_t i;
+
+  for (i = 0; i < idisk->extent_cnt && i < INODE_EXTENTS; i++)
+    total += idisk->extents[i].length;
+  for (i = 0; i < tree_leaves (idisk->extent_cnt); i++)
+    {
+      struct extent_leaf l;
+
+      get_leaf (idisk, i, &l);
+      total += l.length;
+    }
+  return total;
+}
+
+/* Finds the extent of IDISK that covers data sector INDEX.
+   Stores its position into *IDX and the index of the data sector
+   where it begins into *BASE.  Leaves of the extent tree that end
+   before INDEX are skipped without reading them.  Returns false
+   if IDISK's extents do not reach INDEX. */
+static bool
+find_extent (const struct inode_disk *idisk, size_t index,
+             size_t *idx, size_t *base)
+{
+  size_t b = 0;
+  size_t i;
+
+  for (i = 0; i < idisk->extent_cnt; i++)
+    {
+      struct extent e;
+
+      if (starts_leaf (i))
+        {
+          struct extent_leaf l;
+
+          get_leaf (idisk, (i - INODE_EXTENTS) / LEAF_EXTENTS, &l);
+          if (index >= b + l.length)
+            {
+              b += l.length;
+              i += LEAF_EXTENTS - 1;
+              continue;
+            }
+        }
+      get_extent (idisk, i, &e);
+      if (index < b + e.length)
+        {
+          *idx = i;
+          *base = b;
+          return true;
+        }
+      b += e.length;
+    }
+  return false;
+}
+
+/* Stores entry LEAF of INODE's extent tree index into *L.  The
+   index is read into memory the first time it is needed. */
+static void
+inode_get_leaf (struct inode *inode, size_t leaf, struct extent_leaf *l)
+{
+  if (inode->index == NULL)
+    {
+      inode->index = malloc (BLOCK_SECTOR_SIZE);
+      if (inode->index != NULL)
+        cache_read (inode->data.index, inode->index);
+    }
+
+  if (inode->index != NULL)
+    *l = inode->index[leaf];
+  else
+    get_leaf (&inode->data, leaf, l);
+}
+
+/* Stores extent IDX of INODE, which must be in the extent tree,
+   into *E.  The leaf that holds it is read into memory, replacing
+   the one read last time, so that scanning a leaf reads it just
+   once. */
+static void
+inode_get_extent (struct inode *inode, size_t idx, struct extent *e)
+{
+  size_t t = idx - INODE_EXTENTS;
+  size_t leaf = t / LEAF_EXTENTS;
+
+  ASSERT (idx >= INODE_EXTENTS);
+  if (inode->leaf == NULL || inode->leaf_no != leaf)
+    {
+      struct extent_leaf l;
+
+      inode_get_leaf (inode, leaf, &l);
+      if (inode->leaf == NULL)
+        inode->leaf = malloc (BLOCK_SECTOR_SIZE);
+      if (inode->leaf != NULL)
+        {
+          cache_read (l.sector, inode->leaf);
+          inode->leaf_no = leaf;
+        }
+    }
+
+  if (inode->leaf != NULL)
+    *e = inode->leaf[t % LEAF_EXTENTS];
+  else
+    get_extent (&inode->data, idx, e);
+}
+
+/* Drops INODE's copies of its extent tree and its lookup hint.
+   Must be called whenever INODE's extents change. */
+static void
+invalidate_extents (struct inode *inode)
+{
+  free (inode->index);
+  inode->index = NULL;
+  free (inode->leaf);
+  inode->leaf = NULL;
+  inode->hint_idx = 0;
+  inode->hint_base = 0;
+}
+
+/* Returns the sector that holds data sector INDEX of INODE's
+   extent tree, counting from the first sector that the tree
+   covers.  Returns HOLE if INDEX is in a hole, or -1 if the tree
+   does not reach INDEX.  Only the index and a single leaf are
+   examined. */
+static block_sector_t
+tree_to_sector (struct inode *inode, off_t index)
+{
+  size_t leaves = tree_leaves (inode->data.extent_cnt);
+  struct extent_leaf l;
+  size_t leaf, i, end;
+
+  for (leaf = 0; leaf < leaves; leaf++)
+    {
+      inode_get_leaf (inode, leaf, &l);
+      if (index < (off_t) l.length)
+        break;
+      index -= l.length;
+    }
+  if (leaf >= leaves)
+    return -1;
+
+  i = INODE_EXTENTS + leaf * LEAF_EXTENTS;
+  end = i + LEAF_EXTENTS;
+  if (end > inode->data.extent_cnt)
+    end = inode->data.extent_cnt;
+  for (; i < end; i++)
+    {
+      struct extent e;
+
+      inode_get_extent (inode, i, &e);
+      if (index < (off_t) e.length)
+        return e.start != HOLE ? e.start + index : HOLE;
+      index -= e.length;
+    }
+  NOT_REACHED ();
+}
+
+/* Returns the sector that holds data sector INDEX of INODE, that
+   is, the one holding byte offset INDEX * BLOCK_SECTOR_SIZE.
+   Returns HOLE if INDEX is in a hole, or -1 if INODE's extents
+   do not reach INDEX.
+   The search through the extents in the inode starts where the
+   previous lookup ended if INDEX is not before it, so that
+   sequential access does not rescan the extents before it. */
+static block_sector_t
+index_to_sector (struct inode *inode, off_t index)
+{
+  const struct inode_disk *idisk = &inode->data;
+  size_t i = 0;
+  off_t base = 0;
+
+  if (index < 0)
+    return -1;
+  if (index >= inode->hint_base)
+    {
+      i = inode->hint_idx;
+      base = inode->hint_base;
+    }
+
+  for (; i < idisk->extent_cnt && i < INODE_EXTENTS; i++)
+    {
+      const struct extent *e = &idisk->extents[i];
+
+      if (index < base + (off_t) e->length)
+        {
+          inode->hint_idx = i;
+          inode->hint_base = base;
+          return e->start != HOLE ? e->start + (index - base) : HOLE;
+        }
+      base += e->length;
+    }
+  return tree_to_sector (inode, index - base);
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or HOLE if POS is in a hole.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.  The caller must hold INODE's lock, for reading or
+   writing. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  block_sector_t sector = -1;
+
   ASSERT (inode != NULL);
-  if (pos >= 0 && pos <= inode->data.length)
-    return index_to_sector(&inode->data, pos / BLOCK_SECTOR_SIZE);
-  else
-    return -1;
+  if (pos >= 0 && pos < inode->data.length)
+    {
+      lock_acquire (&inode->lookup_lock);
+      sector = index_to_sector (inode, pos / BLOCK_SECTOR_SIZE);
+      lock_release (&inode->lookup_lock);
+    }
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes keyed by sector, so that opening a single
+   inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt of every inode in it. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
 }
 
-//recursive alloc call for indirect and double indirect blocks
-bool inode_alloc_indirect(block_sector_t* block, size_t num_sectors, int level){
-  static char zeros[BLOCK_SECTOR_SIZE];
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
 
-  struct inode_indirect_block_sector indirect_block;
-  if(level == 0){  //base level, also allocates indirect blocks
-    if(*block == 0){  //same as direct block allocation
-      if(!free_map_allocate(1, block)) return false;
-      block_write (fs_device, *block, zeros);
-    }
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
+}
+
+/* Makes sure IDISK has room for CNT more extents, allocating the
+   extent tree's index and spare leaves as needed: each extent
+   inserted into the tree can take a new leaf, either to start a
+   leaf after the last one or to split a full one.  Returns false
+   if it does not and cannot be given room, in which case whatever
+   this call allocated is released again, since a failed write
+   does not write IDISK back.  Otherwise, leaves are not released
+   again until the inode is deleted. */
+static bool
+reserve_extents (struct inode_disk *idisk, size_t cnt)
+{
+  size_t leaves = tree_leaves (idisk->extent_cnt);
+  size_t added[2];
+  size_t added_cnt = 0;
+  size_t spares = 0;
+  bool new_index = false;
+  size_t leaf;
+
+  /* Callers insert at most two extents at a time. */
+  ASSERT (cnt <= sizeof added / sizeof *added);
+
+  if (idisk->extent_cnt + cnt <= INODE_EXTENTS)
     return true;
-  }
-  if(*block == 0){  //same as direct block allocation
-    free_map_allocate(1, block);
-    block_write (fs_device, *block, zeros);
-  }
-  
-  block_read(fs_device, *block, &indirect_block);   //read block into indirect_block_sector for reading
-
-  int blocks = level == 1 ? num_sectors : DIV_ROUND_UP(num_sectors, INDIRECT_BLOCKS_PER_SECTOR);
-  //if level 2, this gets the number of indirect blocks being used by the double indirect block
-  int i;
-
-  for(i = 0; i < blocks; i++){
-    int subsize;
-    if(level == 1){
-      subsize = 1;
-    } else {
-       subsize = (num_sectors < INDIRECT_BLOCKS_PER_SECTOR ? num_sectors : INDIRECT_BLOCKS_PER_SECTOR);
-    }
-    if(!inode_alloc_indirect(&indirect_block.blocks[i], subsize, level -1))
-      return false;
-    num_sectors -= subsize;
-  }
-  //write indirect_block back to block
-  block_write(fs_device, *block, &indirect_block);
+  if (leaves + cnt > INDEX_LEAVES)
+    return false;
+  if (idisk->index == 0)
+    {
+      if (!free_map_allocate_near (idisk->extents[INODE_EXTENTS - 1].start,
+                                   1, &idisk->index))
+        return false;
+      cache_write_meta (idisk->index, zeros);
+      new_index = true;
+    }
+
+  /* Spare leaves are the allocated ones past the last leaf in
+     use. */
+  for (leaf = leaves; leaf < INDEX_LEAVES && spares < cnt; leaf++)
+    {
+      struct extent_leaf l;
+
+      get_leaf (idisk, leaf, &l);
+      if (l.sector == 0)
+        {
+          if (!free_map_allocate_near (idisk->index, 1, &l.sector))
+            goto fail;
+          l.length = 0;
+          set_leaf (idisk, leaf, &l);
+          added[added_cnt++] = leaf;
+        }
+      spares++;
+    }
   return true;
 
+ fail:
+  while (added_cnt > 0)
+    {
+      struct extent_leaf l;
 
+      leaf = added[--added_cnt];
+      get_leaf (idisk, leaf, &l);
+      free_map_release (l.sector, 1);
+      l.sector = 0;
+      set_leaf (idisk, leaf, &l);
+    }
+  if (new_index)
+    {
+      free_map_release (idisk->index, 1);
+      idisk->index = 0;
+    }
+  return false;
 }
 
- //actually reserve all the blocks for the inode
-bool inode_alloc(struct inode_disk* disk_inode, off_t length){
-   int sectors = bytes_to_sectors(length);
-   static char zeros[BLOCK_SECTOR_SIZE];   //used for zeroing out blocks
-   int i;
+/* Moves entry FROM of IDISK's extent tree index to position TO,
+   moving the entries in between over by one. */
+static void
+move_leaf (struct inode_disk *idisk, size_t from, size_t to)
+{
+  struct extent_leaf moved, l;
 
-   // alloc direct blocks
-   int blocks = sectors < DIRECT_BLOCKS_COUNT ? sectors : DIRECT_BLOCKS_COUNT;
-   for(i = 0; i < blocks; i++){
-    if(disk_inode->direct_blocks[i] == 0){   //empty 
-      if(!free_map_allocate(1, &disk_inode->direct_blocks[i])){
-        return false;
-      }
-       block_write (fs_device, disk_inode->direct_blocks[i], zeros);
+  get_leaf (idisk, from, &moved);
+  for (; from > to; from--)
+    {
+      get_leaf (idisk, from - 1, &l);
+      set_leaf (idisk, from, &l);
     }
-   }
-   if((sectors -= blocks) == 0) return true;
+  for (; from < to; from++)
+    {
+      get_leaf (idisk, from + 1, &l);
+      set_leaf (idisk, from, &l);
+    }
+  set_leaf (idisk, to, &moved);
+}
 
-   //alloc indirect blocks
-   blocks = sectors < INDIRECT_BLOCKS_PER_SECTOR ? sectors : INDIRECT_BLOCKS_PER_SECTOR;
-   if(!inode_alloc_indirect(&disk_inode->indirect_block, blocks, 1 ))
-    return false;
-   if((sectors -= blocks) == 0) return true;
+/* Puts a new, empty leaf into IDISK's extent tree as leaf LEAF,
+   which must not be past the leaves in use, moving the leaves
+   from LEAF on up by one.  The new leaf is one of the spares that
+   reserve_extents() allocated.  Does not update EXTENT_CNT. */
+static void
+take_leaf (struct inode_disk *idisk, size_t leaf)
+{
+  size_t spare = tree_leaves (idisk->extent_cnt);
+  struct extent_leaf l;
 
-   //alloc doubly indirect blocks
-   blocks = sectors < INDIRECT_BLOCKS_PER_SECTOR * INDIRECT_BLOCKS_PER_SECTOR
-    ? sectors : INDIRECT_BLOCKS_PER_SECTOR * INDIRECT_BLOCKS_PER_SECTOR;
-   if(!inode_alloc_indirect(&disk_inode->doubly_indirect_block, blocks, 2 ))
-    return false;
+  ASSERT (leaf <= spare);
+  for (;; spare++)
+    {
+      get_leaf (idisk, spare, &l);
+      if (l.sector != 0)
+        break;
+    }
+  cache_write_meta (l.sector, zeros);
+  l.length = 0;
+  set_leaf (idisk, spare, &l);
+  move_leaf (idisk, spare, leaf);
+}
 
-   if((sectors -= blocks) == 0) return true;
-   return false;
+/* Splits full leaf LEAF of IDISK's extent tree in two, moving
+   the extents from slot SLOT on into a new leaf just after it. */
+static void
+split_leaf (struct inode_disk *idisk, size_t leaf, size_t slot)
+{
+  bool last = leaf + 1 == tree_leaves (idisk->extent_cnt);
+  struct extent_leaf old, new;
+  size_t i;
+
+  take_leaf (idisk, leaf + 1);
+  get_leaf (idisk, leaf, &old);
+  get_leaf (idisk, leaf + 1, &new);
+  for (i = slot; i < LEAF_EXTENTS; i++)
+    {
+      struct extent e;
 
+      get_slot (old.sector, i, &e);
+      put_slot (new.sector, i - slot, &e);
+      old.length -= e.length;
+      new.length += e.length;
+    }
+  cache_write_meta_at (old.sector, zeros,
+                       (LEAF_EXTENTS - slot) * sizeof (struct extent),
+                       slot * sizeof (struct extent));
+  set_leaf (idisk, leaf, &old);
+  set_leaf (idisk, leaf + 1, &new);
+  idisk->extent_cnt += last ? LEAF_EXTENTS - slot : LEAF_EXTENTS;
 }
 
-//recursive alloc call for indirect and double indirect blocks
-bool inode_dealloc_indirect(block_sector_t* block, size_t num_sectors, int level){
-  static char zeros[BLOCK_SECTOR_SIZE];
+/* Inserts E into IDISK's extent tree as extent IDX, which must be
+   in a leaf in use or start the leaf after them, moving the
+   extents after it in its leaf up by one.  A full leaf first
+   passes an extent on to a neighbor with room, or, failing that,
+   is split, with the extents after E moving into a new leaf, so
+   that inserting a run of extents in ascending or descending
+   order still fills the leaves.  Returns the position that E
+   ends up in. */
+static size_t
+tree_insert (struct inode_disk *idisk, size_t idx, const struct extent *e)
+{
+  size_t leaves = tree_leaves (idisk->extent_cnt);
+  size_t leaf = (idx - INODE_EXTENTS) / LEAF_EXTENTS;
+  size_t slot = (idx - INODE_EXTENTS) % LEAF_EXTENTS;
+  size_t used;
+
+  ASSERT (leaf <= leaves);
+  if (leaf == leaves)
+    {
+      ASSERT (slot == 0);
+      take_leaf (idisk, leaf);
+      leaves++;
+      used = 0;
+    }
+  else
+    used = leaf_used (idisk, leaf);
 
-  struct inode_indirect_block_sector indirect_block;
-  if(level == 0){  //base level
-    free_map_release(block ,1);
-    return true;
-  }
-  block_read(fs_device, *block, &indirect_block);   //read block into indirect_block_sector for reading
-  
-  int blocks = level == 1 ? num_sectors : DIV_ROUND_UP(num_sectors, INDIRECT_BLOCKS_PER_SECTOR);
-  int i;
-
-  for(i = 0; i < blocks; i++){
-    int subsize;
-    if(level == 1){
-      subsize = 1;
-    } else{
-       subsize = (num_sectors < INDIRECT_BLOCKS_PER_SECTOR ? num_sectors : INDIRECT_BLOCKS_PER_SECTOR);
-    }
-    inode_dealloc_indirect(&indirect_block.blocks[i], subsize, level -1);
-    num_sectors -= subsize;
-  }
-  free_map_release(block, 1);   //release indirect block itself
-  return true;
+  if (used == LEAF_EXTENTS)
+    {
+      size_t next = (leaf + 1 < leaves ? leaf_used (idisk, leaf + 1)
+                     : LEAF_EXTENTS);
+      size_t prev = leaf > 0 ? leaf_used (idisk, leaf - 1) : LEAF_EXTENTS;
+      struct extent moved;
 
+      if (next < LEAF_EXTENTS)
+        {
+          /* Pass the last extent on to the next leaf. */
+          leaf_remove (idisk, leaf, used--, LEAF_EXTENTS - 1, &moved);
+          leaf_insert (idisk, leaf + 1, next, 0, &moved);
+          if (leaf + 1 == leaves - 1)
+            idisk->extent_cnt++;
+        }
+      else if (prev < LEAF_EXTENTS && slot == 0)
+        {
+          /* E itself goes at the end of the previous leaf. */
+          leaf_insert (idisk, leaf - 1, prev, prev, e);
+          return leaf_start (leaf - 1) + prev;
+        }
+      else if (prev < LEAF_EXTENTS)
+        {
+          /* Pass the first extent back to the previous leaf. */
+          leaf_remove (idisk, leaf, used--, 0, &moved);
+          leaf_insert (idisk, leaf - 1, prev, prev, &moved);
+          slot--;
+        }
+      else
+        {
+          split_leaf (idisk, leaf, slot);
+          leaves++;
+          used = slot;
+        }
+    }
 
+  leaf_insert (idisk, leaf, used, slot, e);
+  if (leaf == leaves - 1)
+    idisk->extent_cnt = leaf_start (leaf) + used + 1;
+  return leaf_start (leaf) + slot;
 }
 
-//calls free_map on all data sectors
-bool inode_dealloc(struct inode* inode){
-  int sectors = bytes_to_sectors(inode->data.length);
-   static char zeros[BLOCK_SECTOR_SIZE];   //used for zeroing out blocks
-   int i;
+/* Removes extent IDX from IDISK's extent tree, moving the extents
+   after it in its leaf down by one.  A leaf left empty becomes a
+   spare. */
+static void
+tree_remove (struct inode_disk *idisk, size_t idx)
+{
+  size_t leaves = tree_leaves (idisk->extent_cnt);
+  size_t leaf = (idx - INODE_EXTENTS) / LEAF_EXTENTS;
+  size_t slot = (idx - INODE_EXTENTS) % LEAF_EXTENTS;
+  size_t used = leaf_used (idisk, leaf);
+  struct extent e;
+
+  leaf_remove (idisk, leaf, used--, slot, &e);
+  if (used > 0)
+    {
+      if (leaf == leaves - 1)
+        idisk->extent_cnt--;
+    }
+  else if (leaf < leaves - 1)
+    {
+      move_leaf (idisk, leaf, leaves - 1);
+      idisk->extent_cnt -= LEAF_EXTENTS;
+    }
+  else if (leaf > 0)
+    idisk->extent_cnt = leaf_start (leaf - 1) + leaf_used (idisk, leaf - 1);
+  else
+    idisk->extent_cnt = INODE_EXTENTS;
+}
+
+/* Inserts E into IDISK just after extent IDX - 1, as extent IDX,
+   and returns the position that E ends up in, which differs from
+   IDX if E goes into the leaf before IDX's.  The caller must have
+   reserved room for it.  Besides the inode and the tree's index,
+   only the leaf that E goes into changes, along with the one
+   that takes an extent from it if it is full; inserting into the
+   inode pushes its last extent into the first leaf. */
+static size_t
+insert_extent (struct inode_disk *idisk, size_t idx, const struct extent *e)
+{
+  size_t i;
 
-   // alloc direct blocks
-   int blocks = sectors < DIRECT_BLOCKS_COUNT ? sectors : DIRECT_BLOCKS_COUNT;
-   for(i = 0; i < blocks; i++){
-      free_map_release(inode->data.direct_blocks[i], 1);
-   }
-   if((sectors -= blocks) == 0) return true;
+  ASSERT (idx <= idisk->extent_cnt);
+  if (idx >= INODE_EXTENTS)
+    return tree_insert (idisk, idx, e);
 
-   //alloc indirect blocks
-   blocks = sectors < INDIRECT_BLOCKS_PER_SECTOR ? sectors : INDIRECT_BLOCKS_PER_SECTOR;
-   if(!inode_dealloc_indirect(&inode->data.indirect_block, blocks , 1 ))
-    return false;
-   if((sectors -= blocks) == 0) return true;
+  if (idisk->extent_cnt >= INODE_EXTENTS)
+    {
+      tree_insert (idisk, INODE_EXTENTS,
+                   &idisk->extents[INODE_EXTENTS - 1]);
+      i = INODE_EXTENTS - 1;
+    }
+  else
+    i = idisk->extent_cnt++;
+  for (; i > idx; i--)
+    idisk->extents[i] = idisk->extents[i - 1];
+  idisk->extents[idx] = *e;
+  return idx;
+}
 
-   //alloc doubly indirect blocks
-   blocks = sectors < INDIRECT_BLOCKS_PER_SECTOR * INDIRECT_BLOCKS_PER_SECTOR
-    ? sectors : INDIRECT_BLOCKS_PER_SECTOR * INDIRECT_BLOCKS_PER_SECTOR;
-   if(!inode_dealloc_indirect(&inode->data.doubly_indirect_block, blocks, 2))
+/* Removes extent IDX from IDISK.  Besides the inode, only the leaf
+   that held it changes; removing an extent from the inode pulls
+   the first extent in the tree into it. */
+static void
+remove_extent (struct inode_disk *idisk, size_t idx)
+{
+  size_t i;
+
+  if (idx >= INODE_EXTENTS)
+    {
+      tree_remove (idisk, idx);
+      return;
+    }
+  for (i = idx + 1; i < idisk->extent_cnt && i < INODE_EXTENTS; i++)
+    idisk->extents[i - 1] = idisk->extents[i];
+  if (idisk->extent_cnt > INODE_EXTENTS)
+    {
+      get_extent (idisk, INODE_EXTENTS, &idisk->extents[INODE_EXTENTS - 1]);
+      tree_remove (idisk, INODE_EXTENTS);
+    }
+  else
+    idisk->extent_cnt--;
+}
+
+/* Finds the extent of IDISK before extent IDX, skipping empty
+   slots in the extent tree, and stores its position into *PREV
+   and the extent itself into *E.  Returns false if there is no
+   extent before IDX. */
+static bool
+prev_extent (const struct inode_disk *idisk, size_t idx, size_t *prev,
+             struct extent *e)
+{
+  do
+    {
+      if (idx == 0)
+        return false;
+      get_extent (idisk, --idx, e);
+    }
+  while (e->length == 0);
+  *prev = idx;
+  return true;
+}
+
+/* Makes IDISK's extents cover LENGTH bytes of data, by adding a
+   hole at the end for any sectors they do not cover yet, so that
+   growing a file allocates nothing until its new sectors are
+   written.  Returns false if IDISK has no room for the hole. */
+static bool
+inode_extend (struct inode_disk *idisk, off_t length)
+{
+  size_t need = bytes_to_sectors (length);
+  size_t have = covered_sectors (idisk);
+  struct extent e;
+
+  if (have >= need)
+    return true;
+
+  if (idisk->extent_cnt > 0)
+    get_extent (idisk, idisk->extent_cnt - 1, &e);
+  if (idisk->extent_cnt > 0 && e.start == HOLE)
+    {
+      e.length += need - have;
+      set_extent (idisk, idisk->extent_cnt - 1, &e);
+      return true;
+    }
+  if (!reserve_extents (idisk, 1))
     return false;
+  e.start = HOLE;
+  e.length = need - have;
+  insert_extent (idisk, idisk->extent_cnt, &e);
+  return true;
+}
+
+/* Allocates sectors for data sector INDEX of INODE, which must be
+   in a hole, and for as many of the CNT - 1 sectors after it as
+   are in the same hole.  The sectors extend the extent before the
+   hole in place if the sectors following that extent are free.
+   Otherwise they form a new extent, taken from the largest free
+   run we can find as close as possible after the data before the
+   hole, or after INODE's own sector.  A hole at the end of a file
+   that does not hold metadata also gets some sectors to spare
+   past its end.  Neither those nor the sectors in the hole are
+   zeroed here: the caller writes the ones in the hole, and
+   write_op() zeroes spare sectors once the file grows into
+   them.
+   Returns the number of sectors allocated in the hole, or 0 if
+   the disk or INODE's extents run out. */
+static size_t
+fill_hole (struct inode *inode, size_t index, size_t cnt)
+{
+  struct inode_disk *idisk = &inode->data;
+  block_sector_t goal = inode->sector + 1;
+  struct extent hole, data;
+  size_t idx, base, before, after, want, got, used;
+  size_t prev = 0;
+  bool has_prev;
+
+  /* Find the hole, and aim for just after the data before it. */
+  if (!find_extent (idisk, index, &idx, &base))
+    NOT_REACHED ();
+  get_extent (idisk, idx, &hole);
+  ASSERT (hole.start == HOLE);
+  has_prev = prev_extent (idisk, idx, &prev, &data);
+  if (has_prev && data.start != HOLE)
+    goal = data.start + data.length;
+  before = index - base;
+  if (cnt > hole.length - before)
+    cnt = hole.length - before;
+
+  /* Ask for some room to spare at the end of the file, unless
+     the spare sectors would have to be journaled. */
+  want = cnt;
+  if (idx == idisk->extent_cnt - 1 && before + cnt == hole.length
+      && !holds_metadata (inode))
+    want += index < PREALLOC_MAX ? index : PREALLOC_MAX;
+
+  /* Try to extend the extent just before the hole. */
+  if (before == 0 && has_prev && data.start != HOLE)
+    {
+      got = free_map_allocate_at (data.start + data.length, want);
+      if (got > 0)
+        {
+          used = got < cnt ? got : cnt;
+          data.length += got;
+          set_extent (idisk, prev, &data);
+          hole.length -= used;
+          if (hole.length > 0)
+            set_extent (idisk, idx, &hole);
+          else
+            remove_extent (idisk, idx);
+          return used;
+        }
+    }
+
+  /* Start a new extent, settling for fewer sectors if need be. */
+  got = want;
+  while (!free_map_allocate_near (goal, got, &data.start))
+    {
+      if (got == 1)
+        return 0;
+      got = got > cnt ? cnt : got / 2;
+    }
+  data.length = got;
+  used = got < cnt ? got : cnt;
+  after = hole.length - before - used;
+  if (!reserve_extents (idisk, (before > 0) + (after > 0)))
+    {
+      free_map_release (data.start, got);
+      return 0;
+    }
 
-   if((sectors -= blocks) == 0) return true;
-   return false;
+  /* Replace the hole by what is left of it before the new
+     extent, the new extent, and what is left of it after. */
+  if (before > 0)
+    {
+      hole.length = before;
+      set_extent (idisk, idx, &hole);
+      idx = insert_extent (idisk, idx + 1, &data);
+    }
+  else
+    set_extent (idisk, idx, &data);
+  if (after > 0)
+    {
+      hole.length = after;
+      insert_extent (idisk, idx + 1, &hole);
+    }
+  return used;
+}
+
+/* Releases IDISK's data sectors and its extent tree. */
+static void
+inode_dealloc (struct inode_disk *idisk)
+{
+  size_t i;
+
+  for (i = 0; i < idisk->extent_cnt; i++)
+    {
+      struct extent e;
+
+      get_extent (idisk, i, &e);
+      if (e.start != HOLE)
+        free_map_release (e.start, e.length);
+    }
+  if (idisk->index != 0)
+    {
+      for (i = 0; i < INDEX_LEAVES; i++)
+        {
+          struct extent_leaf l;
+
+          get_leaf (idisk, i, &l);
+          if (l.sector != 0)
+            free_map_release (l.sector, 1);
+        }
+      free_map_release (idisk->index, 1);
+    }
 }
 
 bool
@@ -243,8 +996,6 @@ inode_create (block_sector_t sector, off_t length,bool isDir)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-     
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
           //aldair wrote this
@@ -253,23 +1004,13 @@ inode_create (block_sector_t sector, off_t length,bool isDir)
       if(t->currentDir != NULL){
         disk_inode->parent = t->currentDir->inode->sector;
       }
-      //shouldn't allocate all sectors at once, but rather 1 at a time
-      if (inode_alloc(disk_inode, length))
-     // if (free_map_allocate (sectors, &disk_inode->start)) 
+      if (inode_extend (disk_inode, length))
         {
-          block_write (fs_device, sector, disk_inode);
-          //remaining sectors not allocated
-          //always created with 1 sector, (length = 0)
-          /*if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }*/
+          cache_write_meta (sector, disk_inode);
           success = true; 
         } 
+      else
+        inode_dealloc (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -281,34 +1022,51 @@ inode_create (block_sector_t sector, off_t length,bool isDir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  /* Lookup key.  struct inode is too big to put on the stack,
+     so a single one is shared, under open_inodes_lock. */
+  static struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read while still holding the lock,
+     so that a concurrent open of the same sector waits for it
+     instead of finding it half-initialized. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  cache_read (inode->sector, &inode->data);
   inode->isdir = inode->data.isdir;
+  inode->index = NULL;
+  inode->leaf = NULL;
+  inode->hint_idx = 0;
+  inode->hint_base = 0;
+  lock_init (&inode->lookup_lock);
+  rwlock_init (&inode->lock);
+  rwlock_init (&inode->dir_lock);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -317,7 +1075,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -328,6 +1090,20 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns the sector that holds byte offset POS within INODE's
+   data, FREE_MAP_SECTOR if POS is in a hole, or -1 if INODE has
+   no data at POS. */
+block_sector_t
+inode_get_sector (struct inode *inode, off_t pos)
+{
+  block_sector_t sector;
+
+  rwlock_acquire_read (&inode->lock);
+  sector = byte_to_sector (inode, pos);
+  rwlock_release_read (&inode->lock);
+  return sector;
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
@@ -339,22 +1115,24 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-        {
-          free_map_release (inode->sector, 1);
-          //free_map_release (inode->data.start,
-          //                  bytes_to_sectors (inode->data.length)); 
-          inode_dealloc(inode);   
-        }
+      lock_release (&open_inodes_lock);
+      return;
+    }
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
 
-      free (inode); 
+  /* Deallocate blocks if removed. */
+  if (inode->removed) 
+    {
+      free_map_release (inode->sector, 1);
+      inode_dealloc (&inode->data);
     }
+
+  invalidate_extents (inode);
+  free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -368,22 +1146,33 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   INODE's lock is held for reading only to find each sector,
+   not to copy it.  Since a write that allocates sectors holds
+   the lock for writing throughout, a read sees its new sectors
+   only once they have been written. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Disk sector to read, starting byte offset within sector.
+         The sector and the inode's length are looked up together,
+         so that they agree. */
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      off_t length;
+
+      rwlock_acquire_read (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset);
+      length = inode_length (inode);
+      rwlock_release_read (&inode->lock);
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -392,57 +1181,204 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
-      
+      /* Copy the chunk out of the buffer cache.  A hole reads as
+         zeros. */
+      if (sector_idx != HOLE)
+        cache_read_at (sector_idx, buffer + bytes_read, chunk_size,
+                       sector_ofs);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+/* Asks the buffer cache to fetch up to CNT sectors of INODE's
+   data in the background, starting with the sector that holds
+   byte OFFSET.  Sectors past end of file and holes are
+   skipped. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, int cnt)
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  rwlock_acquire_read (&inode->lock);
+  for (; cnt > 0 && offset < inode_length (inode);
+       cnt--, offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != HOLE)
+        cache_read_ahead (sector);
+    }
+  rwlock_release_read (&inode->lock);
+}
+
+/* Turns the current thread's read hold on INODE's lock into a
+   write hold.  If another thread is already upgrading, releases
+   the lock and waits to acquire it for writing instead, so the
+   caller must check again anything it read under the lock. */
+static void
+lock_for_writing (struct inode *inode)
+{
+  if (!rwlock_upgrade (&inode->lock))
+    {
+      rwlock_release_read (&inode->lock);
+      rwlock_acquire_write (&inode->lock);
+    }
+}
+
+/* Journal slots that a write reserves to begin with: its inode,
+   the extent tree index, and two leaves, enough to extend a file
+   or fill a hole near its end. */
+#define WRITE_SLOTS 4
+
+/* Most leaves of an extent tree that one write can change: two
+   when it extends its file, and when it fills a hole, the hole's
+   leaf and, for each of the two extents that it can insert, the
+   leaf that the extent goes into and one more that takes an
+   extent from it if it is full. */
+#define WRITE_LEAVES 7
+
+/* Returns the most journal slots that writing SIZE bytes at
+   OFFSET into INODE can use, if the write extends INODE and fills
+   one hole: INODE's sector, and, if that can add enough extents
+   to need an extent tree, the tree's index and WRITE_LEAVES
+   leaves.  For a directory or the free map, the data sectors
+   written count too.  The caller must hold INODE's lock for
+   writing. */
+static size_t
+write_slots (struct inode *inode, off_t offset, off_t size)
+{
+  size_t slots = 1;
+
+  if (inode->data.extent_cnt + 3 > INODE_EXTENTS)
+    slots += 1 + WRITE_LEAVES;
+  if (holds_metadata (inode))
+    slots += (bytes_to_sectors (offset + size)
+              - offset / BLOCK_SECTOR_SIZE);
+  return slots;
+}
+
+/* Makes sure that the current journal operation has reserved
+   enough slots for writing SIZE bytes at OFFSET into INODE, whose
+   lock the caller holds for writing.  If it has not and cannot,
+   stores the number it needs into *SLOTS and returns false. */
+static bool
+reserve_write (struct inode *inode, off_t offset, off_t size,
+               size_t *slots)
+{
+  size_t need = write_slots (inode, offset, size);
+
+  if (journal_extend (need))
+    return true;
+  *slots = need;
+  return false;
+}
+
+/* Zeroes INODE's data sectors from index START up to END, or up
+   to INODE's end if that comes first, except those that writing
+   SIZE bytes at OFFSET replaces entirely, and holes.  Used when
+   INODE grows into sectors that fill_hole() allocated to spare
+   past its old end, which hold whatever was on disk.  The caller
+   must hold INODE's lock for writing. */
+static void
+zero_spare (struct inode *inode, size_t start, size_t end,
+            off_t offset, off_t size)
+{
+  size_t file_end = bytes_to_sectors (inode->data.length);
+  size_t i;
+
+  if (end > file_end)
+    end = file_end;
+  for (i = start; i < end; i++)
+    {
+      off_t pos = (off_t) i * BLOCK_SECTOR_SIZE;
+      block_sector_t sector = byte_to_sector (inode, pos);
 
+      if (sector != HOLE
+          && (pos < offset || pos + BLOCK_SECTOR_SIZE > offset + size))
+        write_data (inode, sector, zeros, BLOCK_SECTOR_SIZE, 0);
+    }
+}
+
+/* Writes up to SIZE bytes from BUFFER into INODE, starting at
+   OFFSET, as a single journal operation that reserves *SLOTS
+   slots to begin with.  Stops after filling one hole, since the
+   slots are reserved for one, or before changing INODE's extents
+   if it needs more slots than the operation could get, in which
+   case it stores the number needed into *SLOTS.
+   Returns the number of bytes written, or -1 if the write cannot
+   go on because writes to INODE are denied or the disk or INODE's
+   extents have run out.
+   A write that only overwrites existing data holds INODE's lock
+   for reading, so it can run alongside reads and other such
+   writes; each sector is updated atomically by the buffer cache.
+   A write that extends INODE or fills a hole holds the lock for
+   writing from then on, since it changes INODE's extents. */
+static off_t
+write_op (struct inode *inode, const uint8_t *buffer, off_t size,
+          off_t offset, size_t *slots)
+{
+  off_t bytes_written = 0;
+  off_t old_length;
+  bool changed = false;
+  bool filled = false;
+  bool failed = false;
+  bool exclusive;
+
+  /* Sectors allocated by this write that it has not yet
+     written. */
+  off_t fresh_start = 0, fresh_end = 0;
+
+  /* Changes to INODE's metadata must commit together, so begin
+     the journal operation before taking any locks. */
+  journal_begin (*slots);
+
+  /* Take INODE's lock for writing if the write extends INODE.
+     INODE's length can change until we hold the lock, so check
+     again then. */
+  exclusive = offset + size > inode_length (inode);
+  if (exclusive)
+    rwlock_acquire_write (&inode->lock);
+  else
+    {
+      rwlock_acquire_read (&inode->lock);
+      if (offset + size > inode->data.length)
+        {
+          lock_for_writing (inode);
+          exclusive = true;
+        }
+    }
+  old_length = inode->data.length;
   if (inode->deny_write_cnt)
-    return 0;
-
-  //beyond EOF, file growth
-  if(byte_to_sector(inode, offset + size - 1) == -1){   //check this value???
-    if(!inode_alloc (& inode->data, offset + size)) return 0;
-    inode->data.length = offset + size;
-    block_write (fs_device, inode->sector, &inode->data);  //update inode on disk
-  } //after this, there should be room to write
+    {
+      failed = true;
+      goto done;
+    }
+  if (exclusive && !reserve_write (inode, offset, size, slots))
+    goto done;
+
+  /* Extend the file if writing past end of file, zeroing the
+     spare sectors that it grows into. */
+  if (offset + size > inode->data.length)
+    {
+      size_t spare_start = bytes_to_sectors (inode->data.length);
+      size_t spare_end = covered_sectors (&inode->data);
+      bool ok = inode_extend (&inode->data, offset + size);
+      invalidate_extents (inode);
+      if (!ok)
+        {
+          failed = true;
+          goto done;
+        }
+      inode->data.length = offset + size;
+      changed = true;
+      zero_spare (inode, spare_start, spare_end, offset, size);
+    }
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
@@ -456,42 +1392,109 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
       /* Number of bytes to actually write into this sector. */
       int chunk_size = size < min_left ? size : min_left;
+      off_t index = offset / BLOCK_SECTOR_SIZE;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Allocate sectors for the rest of the write that falls in
+         a hole. */
+      if (sector_idx == HOLE && !exclusive)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Filling the hole changes INODE's extents.  Another
+             writer may fill it first, so look the sector up
+             again. */
+          lock_for_writing (inode);
+          exclusive = true;
+          if (!reserve_write (inode, offset, size, slots))
+            break;
+          continue;
         }
-      else 
+      if (sector_idx == HOLE)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          size_t cnt;
+
+          if (filled)
+            break;
+          cnt = fill_hole (inode, index,
+                           bytes_to_sectors (offset + size) - index);
+          invalidate_extents (inode);
+          if (cnt == 0)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              failed = true;
+              break;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          changed = filled = true;
+          fresh_start = index;
+          fresh_end = index + cnt;
+          sector_idx = byte_to_sector (inode, offset);
         }
 
+      /* Copy the chunk into the buffer cache.  The cache reads
+         in the rest of the sector first if the chunk does not
+         cover all of it, unless the sector is new, in which case
+         the rest must be zeros instead. */
+      if (index >= fresh_start && index < fresh_end
+          && chunk_size < BLOCK_SECTOR_SIZE)
+        write_data (inode, sector_idx, zeros, BLOCK_SECTOR_SIZE, 0);
+      write_data (inode, sector_idx, buffer + bytes_written, chunk_size,
+                  sector_ofs);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  if (changed)
+    {
+      ASSERT (exclusive);
+
+      /* If we stopped early, only keep the part of the extension
+         that was written.  The next operation extends INODE
+         again. */
+      if (size > 0 && inode->data.length > old_length)
+        inode->data.length = offset > old_length ? offset : old_length;
+      cache_write_meta (inode->sector, &inode->data);
+    }
+
+ done:
+  if (exclusive)
+    rwlock_release_write (&inode->lock);
+  else
+    rwlock_release_read (&inode->lock);
+  journal_end ();
+  return failed && bytes_written == 0 ? -1 : bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if an error occurs.  Writing past end of file
+   extends the inode, leaving a hole in any gap.  Sectors in
+   holes are allocated as they are written.
+   The write is made of as many journal operations as it takes to
+   keep each one's changes to INODE's extents within what one
+   operation can reserve. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+  size_t slots = WRITE_SLOTS;
+
+  while (size > 0)
+    {
+      size_t old_slots = slots;
+      off_t n = write_op (inode, buffer + bytes_written, size, offset,
+                          &slots);
+
+      if (n < 0 || (n == 0 && (slots == old_slots
+                               || slots > JOURNAL_OP_MAX)))
+        break;
+      size -= n;
+      offset += n;
+      bytes_written += n;
+    }
   return bytes_written;
 }
 
@@ -500,8 +1503,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -510,9 +1515,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
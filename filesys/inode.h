@@ -4,18 +4,55 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
+#include <hash.h>
 #include <list.h>
 #include "threads/synch.h"
-#define DIRECT_BLOCKS_COUNT 122  
-#define INDIRECT_BLOCKS_PER_SECTOR 128
+
+/* A run of LENGTH consecutive sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    block_sector_t length;              /* Number of sectors. */
+  };
+
+/* Number of extents stored in the inode itself. */
+#define INODE_EXTENTS 61
+
+/* Number of extents in a leaf of the extent tree. */
+#define LEAF_EXTENTS (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+
+/* An entry in the index of an extent tree. */
+struct extent_leaf
+  {
+    block_sector_t sector;              /* Sector holding the leaf. */
+    block_sector_t length;              /* Data sectors its extents cover. */
+  };
+
+/* Number of leaves in an extent tree. */
+#define INDEX_LEAVES (BLOCK_SECTOR_SIZE / sizeof (struct extent_leaf))
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data is the concatenation of its extents, in order.
+   The first INODE_EXTENTS extents are stored here, the rest in
+   a two-level tree: the INDEX sector lists up to INDEX_LEAVES
+   leaf sectors, each with the number of data sectors it covers,
+   and each leaf has slots for LEAF_EXTENTS extents.  A leaf's
+   extents are packed at its start and its other slots are empty,
+   with length 0, so that an extent can be inserted by moving just
+   the extents after it in its leaf.  A full leaf first passes an
+   extent to a neighbor with room, or else is split in two.
+   Extent I is in slot I - INODE_EXTENTS of the tree, counting
+   every slot of each leaf, and EXTENT_CNT is one more than the
+   last slot in use.  Finding the sector for a file offset reads
+   at most the index and one leaf.  The extents may cover more
+   sectors than LENGTH needs. */
 struct inode_disk
   {
-    block_sector_t direct_blocks [DIRECT_BLOCKS_COUNT];               /* First data sector. */
-    block_sector_t indirect_block;  //sector number of block holding inode_indirect_block_sector
-    block_sector_t doubly_indirect_block;  //sector number of block holding inode_indirect_block_sector which points to yet more of them
+    struct extent extents[INODE_EXTENTS]; /* Data extents. */
+    uint32_t extent_cnt;                /* Extent slots in use. */
+    block_sector_t index;               /* Extent tree index, or 0. */
     off_t length;                       /* File size in bytes. */
     bool isdir;
     block_sector_t parent;  //block holding parent directory
@@ -24,16 +61,30 @@ struct inode_disk
 
   struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+
+    /* Extent lookup cache, so that locating a sector does not
+       rescan the extents or reread the extent tree.  Readers of
+       the inode share LOCK, so this has a lock of its own. */
+    struct lock lookup_lock;            /* Protects the members below. */
+    struct extent_leaf *index;          /* Copy of tree index, or null. */
+    struct extent *leaf;                /* Copy of one tree leaf, or null... */
+    size_t leaf_no;                     /* ...and which leaf it is. */
+    size_t hint_idx;                    /* Extent of the last lookup... */
+    off_t hint_base;                    /* ...and its first data sector index. */
     
     //off_t read_length;
     bool isdir;
-    struct lock lock;    
+    struct rwlock lock;                 /* Read to use DATA, write to
+                                           change it or DENY_WRITE_CNT. */
+    struct rwlock dir_lock;             /* Read to search a directory's
+                                           entries, write to change them.
+                                           Acquire before LOCK. */
     int numEntries;
   };
 
@@ -44,10 +95,12 @@ bool inode_create (block_sector_t, off_t,bool isDir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+block_sector_t inode_get_sector (struct inode *, off_t);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, int cnt);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
@@ -0,0 +1,427 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata journal.
+
+   Metadata sectors -- inodes, extent tree sectors, and
+   directories -- are written into the buffer cache as usual, but
+   the cache holds on to them instead of writing them back until
+   the running transaction commits.  A commit writes the new
+   contents of all of them, along with the free map sectors that
+   have changed, to the journal with a single request, then the
+   header, which lists where each of them belongs.  Writing the header is the commit point.  Only then
+   do the sectors go to their homes, in sector order, after which
+   the header is marked empty again.  If the system crashes after
+   the commit point, journal_open() finds the committed header at
+   the next boot and copies the sectors home again, so each
+   transaction reaches the disk entirely or not at all.
+
+   File system operations run between journal_begin() and
+   journal_end().  A commit waits for the operations in progress
+   to end and holds off new ones, so a transaction never contains
+   half of an operation, and commits are batched: the flusher
+   commits every cache_flush_interval milliseconds, or sooner when
+   a transaction grows large.  File data is not journaled, but it
+   is written back before each commit, so committed metadata
+   never points to sectors whose data never reached the disk.
+
+   The log has room for JOURNAL_SLOTS sectors from the cache, so
+   each operation reserves slots for the most sectors it can
+   change when it begins.  If the running transaction lacks room
+   for them, the operation commits it first.  The free map is
+   copied into the log straight from memory, rather than held in
+   the cache, and the log has a slot for every sector of the free
+   map file besides, so journal_create() sizes the log from the
+   size of the disk.  Sectors that an operation frees stay in use
+   until its transaction commits; see free_map_release(). */
+
+#define JOURNAL_MAGIC 0x4c4e524a        /* "JRNL". */
+
+/* Most sectors that the log can hold, as many as the header has
+   room to list. */
+#define JOURNAL_LOG_MAX 122
+
+/* Journal header, in sector JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t committed;                 /* Does the log hold a commit? */
+    uint32_t seq;                       /* Last transaction committed. */
+    uint32_t cnt;                       /* Number of sectors logged. */
+    uint32_t checksum;                  /* Hash of HOMES and the log. */
+    block_sector_t homes[JOURNAL_LOG_MAX]; /* Logged sectors' homes. */
+    uint32_t slots;                     /* Sectors in the log. */
+  };
+
+/* False until journal_open() finds a journal, and after
+   journal_close(), in which case metadata is not journaled. */
+static bool active;
+
+/* Number of the last transaction committed. */
+static uint32_t seq;
+
+/* Sectors in the log. */
+static size_t log_slots;
+
+/* The header and log that commit_transaction() fills in,
+   allocated once so that committing never runs out of memory. */
+static struct journal_header *commit_header;
+static uint8_t *commit_log;
+
+/* Operations in progress, and commits. */
+static struct lock journal_lock;        /* Protects the members below. */
+static int handles;                     /* Operations in progress. */
+static size_t reserved;                 /* Slots they have reserved. */
+static bool committing;                 /* Commit in progress? */
+static struct condition quiet;          /* Signaled when HANDLES is 0. */
+static struct condition resumed;        /* Signaled when a commit ends. */
+
+/* Serializes commits. */
+static struct lock commit_lock;
+
+static void commit (bool close);
+
+/* Returns the checksum of the CNT sectors in LOG, which belong in
+   the sectors listed in H. */
+static uint32_t
+checksum (const struct journal_header *h, const uint8_t *log, size_t cnt)
+{
+  return (hash_bytes (h->homes, cnt * sizeof *h->homes)
+          ^ hash_bytes (log, cnt * BLOCK_SECTOR_SIZE));
+}
+
+/* Initializes the journal module.  Until journal_open() is
+   called, commits just write back the cache, and frees take
+   effect at once. */
+void
+journal_init (void)
+{
+  lock_init (&journal_lock);
+  lock_init (&commit_lock);
+  cond_init (&quiet);
+  cond_init (&resumed);
+  handles = 0;
+  reserved = 0;
+  committing = false;
+  active = false;
+}
+
+/* Returns the number of sectors that the log needs: JOURNAL_SLOTS
+   for the cache, plus one for each sector of the free map file.
+   Must be called after free_map_init(). */
+static size_t
+needed_slots (void)
+{
+  return JOURNAL_SLOTS + free_map_file_sectors ();
+}
+
+/* Reserves the journal's sectors and writes an empty journal to
+   them, with a log big enough for the file system device.  Must
+   be called while formatting, after free_map_init() and before
+   anything else is allocated.  Panics if the device is too big to
+   journal. */
+void
+journal_create (void)
+{
+  struct journal_header *h;
+  size_t slots = needed_slots ();
+
+  ASSERT (sizeof *h == BLOCK_SECTOR_SIZE);
+
+  if (slots > JOURNAL_LOG_MAX)
+    PANIC ("file system too big to journal (free map is %zu sectors, "
+           "at most %d allowed)", free_map_file_sectors (),
+           JOURNAL_LOG_MAX - JOURNAL_SLOTS);
+  if (free_map_allocate_at (JOURNAL_SECTOR, 1 + slots) != 1 + slots)
+    PANIC ("journal creation failed");
+
+  h = calloc (1, sizeof *h);
+  if (h == NULL)
+    PANIC ("journal creation failed");
+  h->magic = JOURNAL_MAGIC;
+  h->slots = slots;
+  block_write (fs_device, JOURNAL_SECTOR, h);
+  free (h);
+}
+
+/* Opens the journal, first replaying the transaction it holds if
+   the system stopped after committing it but before writing all
+   of it back.  Without a journal on disk, because the file system
+   was formatted before journaling existed, metadata is written
+   back without one.  Panics if the log is too small for the free
+   map.  Must be called after free_map_init() and before anything
+   reads the file system through the cache. */
+void
+journal_open (void)
+{
+  struct journal_header *h;
+  uint8_t *log;
+  size_t i;
+
+  h = commit_header = malloc (sizeof *h);
+  if (h == NULL)
+    PANIC ("can't open journal");
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != JOURNAL_MAGIC)
+    printf ("filesys: no journal, metadata updates are not atomic\n");
+  else
+    {
+      log_slots = h->slots;
+      if (log_slots < needed_slots () || log_slots > JOURNAL_LOG_MAX)
+        PANIC ("journal has %zu slots, file system needs %zu",
+               log_slots, needed_slots ());
+      log = commit_log = malloc (log_slots * BLOCK_SECTOR_SIZE);
+      if (log == NULL)
+        PANIC ("can't open journal");
+
+      if (h->committed && h->cnt <= log_slots)
+        {
+          block_read_multiple (fs_device, JOURNAL_SECTOR + 1, log, h->cnt);
+          if (checksum (h, log, h->cnt) == h->checksum)
+            {
+              printf ("filesys: replaying journal transaction %"PRIu32
+                      " (%"PRIu32" sectors)\n", h->seq, h->cnt);
+              for (i = 0; i < h->cnt; i++)
+                block_write (fs_device, h->homes[i],
+                             log + i * BLOCK_SECTOR_SIZE);
+            }
+          h->committed = false;
+          block_write (fs_device, JOURNAL_SECTOR, h);
+        }
+      seq = h->seq;
+      active = true;
+    }
+}
+
+/* Returns true if metadata is being journaled. */
+bool
+journal_is_active (void)
+{
+  return active;
+}
+
+/* Returns true if the running transaction has room for SLOTS
+   more sectors.  Sectors already held for it count against its
+   room, as do the slots reserved by the operations in progress,
+   even though some of those may be the same sectors.  The caller
+   must hold journal_lock. */
+static bool
+has_room (size_t slots)
+{
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  return cache_journaled_count () + reserved + slots <= JOURNAL_SLOTS;
+}
+
+/* Begins a file system operation, whose changes to metadata will
+   be committed together, reserving room in the running
+   transaction for SLOTS metadata sectors, at most JOURNAL_OP_MAX,
+   which must be at least as many as the operation can change.
+   Waits for any commit in progress to finish, and commits the
+   running transaction first if it does not have room.  Operations
+   may nest, in which case only the outermost one counts, and its
+   reservation must cover the nested ones.  Must not be called
+   while holding a lock that an operation in progress might wait
+   for, since a commit waits for them all to end. */
+void
+journal_begin (size_t slots)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth > 0)
+    {
+      t->journal_depth++;
+      return;
+    }
+  ASSERT (slots <= JOURNAL_OP_MAX);
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      while (committing)
+        cond_wait (&resumed, &journal_lock);
+      if (!active || has_room (slots))
+        break;
+      lock_release (&journal_lock);
+      journal_commit ();
+      lock_acquire (&journal_lock);
+    }
+  t->journal_slots = 0;
+  if (active)
+    {
+      handles++;
+      reserved += slots;
+      t->journal_slots = slots;
+    }
+  t->journal_depth = 1;
+  lock_release (&journal_lock);
+}
+
+/* Raises the number of slots that the current thread's operation
+   has reserved to SLOTS, without waiting.  Returns true if
+   successful, false if the running transaction does not have room
+   for them, in which case the caller should end the operation and
+   begin another with the larger reservation.  In a nested
+   operation, just returns true, since the outermost operation's
+   reservation must already cover it. */
+bool
+journal_extend (size_t slots)
+{
+  struct thread *t = thread_current ();
+  bool success = true;
+
+  ASSERT (t->journal_depth > 0);
+  if (t->journal_depth > 1)
+    {
+      ASSERT (!active || slots <= t->journal_slots);
+      return true;
+    }
+  if (slots <= t->journal_slots)
+    return true;
+
+  lock_acquire (&journal_lock);
+  if (active)
+    {
+      success = (slots <= JOURNAL_OP_MAX
+                 && has_room (slots - t->journal_slots));
+      if (success)
+        {
+          reserved += slots - t->journal_slots;
+          t->journal_slots = slots;
+        }
+    }
+  lock_release (&journal_lock);
+  return success;
+}
+
+/* Ends the file system operation begun by the matching call to
+   journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (active)
+    {
+      reserved -= t->journal_slots;
+      if (--handles == 0)
+        cond_broadcast (&quiet, &journal_lock);
+    }
+  t->journal_slots = 0;
+  lock_release (&journal_lock);
+}
+
+/* Writes the metadata sectors that the cache holds for the
+   running transaction and the free map sectors that have changed
+   to the log, commits them, writes them to their homes, and
+   empties the log. */
+static void
+commit_transaction (void)
+{
+  struct journal_header *h = commit_header;
+  size_t cached, cnt, i;
+
+  memset (h, 0, sizeof *h);
+  h->slots = log_slots;
+  cached = cache_collect_journaled (h->homes, commit_log, JOURNAL_SLOTS);
+  cnt = cached + free_map_collect (h->homes + cached,
+                                   commit_log + cached * BLOCK_SECTOR_SIZE,
+                                   log_slots - cached);
+  if (cnt > 0)
+    {
+      block_write_multiple (fs_device, JOURNAL_SECTOR + 1, commit_log, cnt);
+      h->magic = JOURNAL_MAGIC;
+      h->committed = true;
+      h->seq = ++seq;
+      h->cnt = cnt;
+      h->checksum = checksum (h, commit_log, cnt);
+      block_write (fs_device, JOURNAL_SECTOR, h);
+
+      /* The free map sectors go home through the cache too, so
+         that it does not keep stale copies of them. */
+      cache_release_journaled ();
+      for (i = cached; i < cnt; i++)
+        cache_write (h->homes[i], commit_log + i * BLOCK_SECTOR_SIZE);
+      cache_flush ();
+      h->committed = false;
+      block_write (fs_device, JOURNAL_SECTOR, h);
+    }
+}
+
+/* Commits the running transaction, once the operations in
+   progress have ended, after writing back file data, and then
+   lets the sectors it freed be reused.  Without a journal, just
+   syncs the free map and writes back everything, without waiting
+   for anything.  If CLOSE is true, stops journaling. */
+static void
+commit (bool close)
+{
+  struct thread *t = thread_current ();
+  bool journaling;
+
+  ASSERT (t->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  journaling = active;
+  if (journaling)
+    {
+      committing = true;
+      while (handles > 0)
+        cond_wait (&quiet, &journal_lock);
+    }
+  lock_release (&journal_lock);
+
+  if (!journaling)
+    free_map_sync ();
+  cache_flush ();
+  if (journaling)
+    {
+      commit_transaction ();
+      free_map_release_deferred ();
+    }
+
+  lock_acquire (&journal_lock);
+  if (close)
+    active = false;
+  committing = false;
+  cond_broadcast (&resumed, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction.  Called periodically by the
+   buffer cache's flusher. */
+void
+journal_commit (void)
+{
+  lock_acquire (&commit_lock);
+  commit (false);
+  lock_release (&commit_lock);
+}
+
+/* Commits the running transaction and stops journaling, so that
+   the file system can be shut down.  The first commit frees the
+   sectors that the last transaction released, and the second
+   commits the free map sectors that this changes. */
+void
+journal_close (void)
+{
+  lock_acquire (&commit_lock);
+  commit (false);
+  commit (true);
+  lock_release (&commit_lock);
+}
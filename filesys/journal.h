@@ -0,0 +1,31 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/filesys.h"
+
+/* Metadata journal.
+
+   The journal starts at JOURNAL_SECTOR: a header, then a log with
+   room for the new contents of up to JOURNAL_SLOTS metadata
+   sectors, which is also the most that one transaction can
+   change, and of every sector of the free map file.  The header
+   records the size of the log. */
+#define JOURNAL_SLOTS 32
+
+/* Most slots that one file system operation may reserve. */
+#define JOURNAL_OP_MAX 20
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+bool journal_is_active (void);
+
+void journal_begin (size_t slots);
+bool journal_extend (size_t slots);
+void journal_end (void);
+void journal_commit (void);
+
+#endif /* filesys/journal.h */
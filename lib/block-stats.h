@@ -0,0 +1,28 @@
+#ifndef __LIB_BLOCK_STATS_H
+#define __LIB_BLOCK_STATS_H
+
+#include <stdint.h>
+
+/* Number of buckets in a latency histogram.  Bucket I counts
+   requests that took from 2**I to 2**(I+1) - 1 CPU cycles between
+   submission and completion.  The last bucket also counts any
+   requests that took longer. */
+#define BLOCK_LATENCY_BUCKETS 40
+
+/* Statistics for one block device, shared between the kernel and
+   user programs that call blockstats(). */
+struct block_stats
+  {
+    char name[16];              /* Block device name, e.g. "hda1". */
+    uint64_t read_cnt;          /* Sectors read. */
+    uint64_t write_cnt;         /* Sectors written. */
+    uint64_t read_reqs;         /* Read requests. */
+    uint64_t write_reqs;        /* Write requests. */
+    uint64_t seq_reqs;          /* Requests that started at the sector
+                                   after the previous request's last. */
+    uint32_t max_depth;         /* Most requests outstanding at once. */
+    uint32_t read_latency[BLOCK_LATENCY_BUCKETS];  /* Reads by latency. */
+    uint32_t write_latency[BLOCK_LATENCY_BUCKETS]; /* Writes by latency. */
+  };
+
+#endif /* lib/block-stats.h */
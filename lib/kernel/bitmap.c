@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -358,6 +359,46 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes only the bytes of B that hold the CNT bits starting at
+   START to the same position in FILE, which must already hold a
+   copy of B written by bitmap_write().  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return true;
+  ofs = start / CHAR_BIT;
+  size = DIV_ROUND_UP (start + cnt, CHAR_BIT) - ofs;
+  return file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs) == size;
+}
+
+/* Copies the bytes of B that hold the CNT bits starting at START,
+   which must be a multiple of CHAR_BIT, into BUFFER, in the same
+   format as bitmap_write(), and returns the number of bytes
+   copied. */
+size_t
+bitmap_copy_range (const struct bitmap *b, size_t start, size_t cnt,
+                   void *buffer)
+{
+  size_t ofs, size;
+
+  ASSERT (start % CHAR_BIT == 0);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  ofs = start / CHAR_BIT;
+  size = DIV_ROUND_UP (start + cnt, CHAR_BIT) - ofs;
+  memcpy (buffer, (uint8_t *) b->bits + ofs, size);
+  return size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -28,7 +28,9 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_READDIR_MULTI,          /* Reads several directory entries. */
+    SYS_BLOCKSTATS              /* Reads block device statistics. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -171,6 +171,12 @@ readdir (int fd, char name[READDIR_MAX_LEN + 1])
   return syscall2 (SYS_READDIR, fd, name);
 }
 
+int
+readdir_multi (int fd, char names[][READDIR_MAX_LEN + 1], int cnt)
+{
+  return syscall3 (SYS_READDIR_MULTI, fd, names, cnt);
+}
+
 bool
 isdir (int fd) 
 {
@@ -182,3 +188,9 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+blockstats (struct block_stats stats[], int cnt)
+{
+  return syscall2 (SYS_BLOCKSTATS, stats, cnt);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <block-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -42,7 +43,9 @@ void munmap (mapid_t);
 bool chdir (const char *dir);
 bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
+int readdir_multi (int fd, char names[][READDIR_MAX_LEN + 1], int cnt);
 bool isdir (int fd);
 int inumber (int fd);
+int blockstats (struct block_stats stats[], int cnt);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,121 @@
+/* Reads the block device statistics with blockstats(), writes
+   and then reads back a file several times the size of the
+   buffer cache, and checks that the disks' sector and request
+   counts went up by at least as much as the cache could not
+   absorb. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Most block devices we look at. */
+#define DEVICE_MAX 8
+
+/* Sectors in the file, and sectors the kernel's buffer cache
+   holds.  A sector written or read through the cache reaches the
+   device unless it is still among the last CACHE_SECTORS. */
+#define FILE_SECTORS 256
+#define CACHE_SECTORS 64
+
+static struct block_stats before[DEVICE_MAX], after[DEVICE_MAX];
+static char sector[512];
+
+/* Totals over every whole disk. */
+struct totals
+  {
+    uint64_t read_cnt, write_cnt, read_reqs, write_reqs;
+  };
+
+/* Returns true if device I among the CNT in STATS is a partition
+   of another one.  A partition's name is its disk's name followed
+   by a number, e.g. "hda1" on "hda", and each request to it is
+   counted again on the disk. */
+static bool
+is_partition (const struct block_stats stats[], int cnt, int i)
+{
+  int j;
+
+  for (j = 0; j < cnt; j++)
+    {
+      size_t len = strlen (stats[j].name);
+      if (j != i && len < strlen (stats[i].name)
+          && !memcmp (stats[i].name, stats[j].name, len))
+        return true;
+    }
+  return false;
+}
+
+/* Reads the statistics of the DEVICE_MAX first block devices into
+   STATS and adds up those of whole disks into *T, so that no
+   request is counted twice.  Returns the number of devices
+   read. */
+static int
+get_totals (struct block_stats stats[], struct totals *t)
+{
+  int cnt = blockstats (stats, DEVICE_MAX);
+  int i;
+
+  if (cnt < 1)
+    fail ("blockstats returned %d", cnt);
+  if (cnt > DEVICE_MAX)
+    cnt = DEVICE_MAX;
+  memset (t, 0, sizeof *t);
+  for (i = 0; i < cnt; i++)
+    {
+      if (stats[i].name[0] == '\0')
+        fail ("block device %d has no name", i);
+      if (stats[i].read_reqs > stats[i].read_cnt
+          || stats[i].write_reqs > stats[i].write_cnt)
+        fail ("%s has more requests than sectors", stats[i].name);
+      if (is_partition (stats, cnt, i))
+        continue;
+      t->read_cnt += stats[i].read_cnt;
+      t->write_cnt += stats[i].write_cnt;
+      t->read_reqs += stats[i].read_reqs;
+      t->write_reqs += stats[i].write_reqs;
+    }
+  return cnt;
+}
+
+void
+test_main (void) 
+{
+  struct totals t0, t1, t2;
+  int cnt, fd, i;
+
+  cnt = blockstats (NULL, 0);
+  CHECK (cnt >= 1, "blockstats with no room (must return device count)");
+  CHECK (get_totals (before, &t0) == (cnt < DEVICE_MAX ? cnt : DEVICE_MAX),
+         "blockstats");
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  msg ("write %d sectors", FILE_SECTORS);
+  for (i = 0; i < FILE_SECTORS; i++)
+    {
+      memset (sector, i, sizeof sector);
+      if (write (fd, sector, sizeof sector) != (int) sizeof sector)
+        fail ("write sector %d failed", i);
+    }
+  get_totals (after, &t1);
+  if (t1.write_cnt < t0.write_cnt + FILE_SECTORS - CACHE_SECTORS
+      || t1.write_reqs <= t0.write_reqs)
+    fail ("sectors written went from %llu to %llu in %llu requests",
+          t0.write_cnt, t1.write_cnt, t1.write_reqs - t0.write_reqs);
+  msg ("write counts increased");
+
+  msg ("read %d sectors", FILE_SECTORS);
+  seek (fd, 0);
+  for (i = 0; i < FILE_SECTORS; i++)
+    if (read (fd, sector, sizeof sector) != (int) sizeof sector
+        || sector[0] != (char) i || sector[sizeof sector - 1] != (char) i)
+      fail ("read sector %d failed", i);
+  get_totals (after, &t2);
+  if (t2.read_cnt < t1.read_cnt + FILE_SECTORS - CACHE_SECTORS
+      || t2.read_reqs <= t1.read_reqs)
+    fail ("sectors read went from %llu to %llu in %llu requests",
+          t1.read_cnt, t2.read_cnt, t2.read_reqs - t1.read_reqs);
+  msg ("read counts increased");
+  close (fd);
+}
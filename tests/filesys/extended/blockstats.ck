@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(blockstats) begin
+(blockstats) blockstats with no room (must return device count)
+(blockstats) blockstats
+(blockstats) create "data"
+(blockstats) open "data"
+(blockstats) write 256 sectors
+(blockstats) write counts increased
+(blockstats) read 256 sectors
+(blockstats) read counts increased
+(blockstats) end
+EOF
+pass;
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+for my $round (0...3) {
+    for (my $i = 0; $i < 40; $i += 8) {
+	$fs->{'d'}{"k$round-$i"} = [chr (ord ('a') + $round) x 600];
+    }
+}
+check_archive ($fs);
+check_fsck ();
+pass;
@@ -0,0 +1,96 @@
+/* Creates and removes many files and directories, in rounds
+   that each create a directory of files and then remove most of
+   the previous round's files and its directory, so that most of
+   the sectors allocated are freed again.  The persistence check
+   then makes sure that the rest survived and that no sector was
+   leaked. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUND_CNT 4             /* Rounds of creating and removing. */
+#define FILE_CNT 40             /* Files created in each round. */
+#define KEEP_EVERY 8            /* Keeps every KEEP_EVERY'th file. */
+#define FILE_SIZE 600           /* Bytes in each file. */
+
+static char buf[FILE_SIZE];
+
+/* Creates a file named NAME holding the contents of BUF. */
+static void
+write_file (const char *name)
+{
+  int fd;
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"%s\"", name);
+  close (fd);
+}
+
+/* Creates directory "d/rROUND" holding files "f0", "f1", ...,
+   and files "d/kROUND-0", "d/kROUND-1", ..., all of them filled
+   with the letter for ROUND. */
+static void
+create_round (int round)
+{
+  char name[32];
+  int i;
+
+  msg ("round %d: creating %d files", round, 2 * FILE_CNT);
+  quiet = true;
+  memset (buf, 'a' + round, sizeof buf);
+  snprintf (name, sizeof name, "d/r%d", round);
+  CHECK (mkdir (name), "mkdir \"%s\"", name);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "d/r%d/f%d", round, i);
+      write_file (name);
+      snprintf (name, sizeof name, "d/k%d-%d", round, i);
+      write_file (name);
+    }
+  quiet = false;
+}
+
+/* Removes directory "d/rROUND" and the files in it, and all but
+   every KEEP_EVERY'th of files "d/kROUND-0", "d/kROUND-1",
+   .... */
+static void
+remove_round (int round)
+{
+  char name[32];
+  int i;
+
+  msg ("round %d: removing most files", round);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "d/r%d/f%d", round, i);
+      CHECK (remove (name), "remove \"%s\"", name);
+      if (i % KEEP_EVERY != 0)
+        {
+          snprintf (name, sizeof name, "d/k%d-%d", round, i);
+          CHECK (remove (name), "remove \"%s\"", name);
+        }
+    }
+  snprintf (name, sizeof name, "d/r%d", round);
+  CHECK (remove (name), "remove \"%s\"", name);
+  quiet = false;
+}
+
+void
+test_main (void)
+{
+  int round;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  for (round = 0; round < ROUND_CNT; round++)
+    {
+      create_round (round);
+      if (round > 0)
+        remove_round (round - 1);
+    }
+  remove_round (ROUND_CNT - 1);
+}
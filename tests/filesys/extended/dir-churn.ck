@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-churn) begin
+(dir-churn) mkdir "d"
+(dir-churn) round 0: creating 80 files
+(dir-churn) round 1: creating 80 files
+(dir-churn) round 0: removing most files
+(dir-churn) round 2: creating 80 files
+(dir-churn) round 1: removing most files
+(dir-churn) round 3: creating 80 files
+(dir-churn) round 2: removing most files
+(dir-churn) round 3: removing most files
+(dir-churn) end
+EOF
+pass;
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Same as name_hash() in dir-hash-overflow.c.
+sub name_hash {
+    my ($hash) = 2166136261;
+    $hash = (($hash * 16777619) % 2**32) ^ ord ($_) foreach split (//, $_[0]);
+    return $hash;
+}
+
+# The colliding names that dir-hash-overflow.c creates, of which
+# it removes every other one.
+my (@collide);
+my ($want) = name_hash ('c0') & 127;
+for (my $n = 0; @collide < 30; $n++) {
+    push (@collide, "c$n") if (name_hash ("c$n") & 127) == $want;
+}
+
+my ($fs);
+$fs->{'a'}{"f$_"} = [''] foreach 0...59;
+$fs->{'a'}{$collide[$_]} = [''] foreach grep ($_ % 2, 0...29);
+check_archive ($fs);
+pass;
@@ -0,0 +1,160 @@
+/* Creates 60 files in a directory, enough to split its first
+   bucket more than once, and then 30 more whose names all hash
+   to the same bucket, more than a bucket holds, so that the
+   bucket is split as far as it goes and then gets an overflow
+   bucket.  Checks that every file can be opened and that
+   readdir() returns each of them once, then removes half of the
+   colliding files and checks again. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PLAIN_CNT 60            /* Files named "f0", "f1", .... */
+#define COLLIDE_CNT 30          /* Files whose names collide. */
+#define HASH_BITS 7             /* Most hash bits a directory uses. */
+
+static char collide[COLLIDE_CNT][READDIR_MAX_LEN + 1];
+
+/* Returns the hash of NAME that the file system uses to place
+   directory entries: 32-bit Fowler-Noll-Vo. */
+static unsigned
+name_hash (const char *name)
+{
+  unsigned hash = 2166136261u;
+
+  while (*name != '\0')
+    hash = (hash * 16777619u) ^ (unsigned char) *name++;
+  return hash;
+}
+
+/* Fills in COLLIDE with the first COLLIDE_CNT names of the form
+   "c<n>" whose hashes agree with that of "c0" in the low
+   HASH_BITS bits. */
+static void
+find_colliding_names (void)
+{
+  unsigned mask = (1u << HASH_BITS) - 1;
+  unsigned want = name_hash ("c0") & mask;
+  int cnt = 0;
+  int n;
+
+  for (n = 0; cnt < COLLIDE_CNT; n++)
+    {
+      snprintf (collide[cnt], sizeof collide[cnt], "c%d", n);
+      if ((name_hash (collide[cnt]) & mask) == want)
+        cnt++;
+    }
+}
+
+/* Returns "a/NAME", in a static buffer. */
+static const char *
+in_dir (const char *name)
+{
+  static char path[READDIR_MAX_LEN + 3];
+
+  snprintf (path, sizeof path, "a/%s", name);
+  return path;
+}
+
+/* Checks that "a/NAME" can be opened if EXISTS is true, or
+   cannot be otherwise. */
+static void
+check_exists (const char *name, bool exists)
+{
+  const char *path = in_dir (name);
+  int fd;
+
+  fd = open (path);
+  if (exists && fd < 2)
+    fail ("open \"%s\"", path);
+  if (!exists && fd >= 0)
+    fail ("\"%s\" still exists after removal", path);
+  if (fd >= 2)
+    close (fd);
+}
+
+/* Checks that reading directory "a" returns each of the CNT
+   files in it exactly once. */
+static void
+check_readdir (int cnt)
+{
+  char name[READDIR_MAX_LEN + 1];
+  bool plain_seen[PLAIN_CNT];
+  bool collide_seen[COLLIDE_CNT];
+  bool *seen;
+  int total = 0;
+  int fd, i;
+
+  memset (plain_seen, 0, sizeof plain_seen);
+  memset (collide_seen, 0, sizeof collide_seen);
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  while (readdir (fd, name))
+    {
+      seen = NULL;
+      if (name[0] == 'f')
+        {
+          i = atoi (name + 1);
+          if (i >= 0 && i < PLAIN_CNT)
+            seen = &plain_seen[i];
+        }
+      else
+        for (i = 0; i < COLLIDE_CNT; i++)
+          if (!strcmp (name, collide[i]))
+            seen = &collide_seen[i];
+      if (seen == NULL)
+        fail ("readdir returned unexpected name \"%s\"", name);
+      if (*seen)
+        fail ("readdir returned \"%s\" twice", name);
+      *seen = true;
+      total++;
+    }
+  close (fd);
+  if (total != cnt)
+    fail ("readdir returned %d entries, but \"a\" holds %d", total, cnt);
+  msg ("read %d entries", total);
+}
+
+void
+test_main (void)
+{
+  char name[READDIR_MAX_LEN + 1];
+  int i;
+
+  find_colliding_names ();
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+
+  msg ("creating %d files", PLAIN_CNT);
+  for (i = 0; i < PLAIN_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!create (in_dir (name), 0))
+        fail ("create \"%s\"", in_dir (name));
+    }
+
+  msg ("creating %d files whose names hash to one bucket", COLLIDE_CNT);
+  for (i = 0; i < COLLIDE_CNT; i++)
+    if (!create (in_dir (collide[i]), 0))
+      fail ("create \"%s\"", in_dir (collide[i]));
+
+  msg ("opening every file");
+  for (i = 0; i < PLAIN_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      check_exists (name, true);
+    }
+  for (i = 0; i < COLLIDE_CNT; i++)
+    check_exists (collide[i], true);
+  check_readdir (PLAIN_CNT + COLLIDE_CNT);
+
+  msg ("removing every other colliding file");
+  for (i = 0; i < COLLIDE_CNT; i += 2)
+    if (!remove (in_dir (collide[i])))
+      fail ("remove \"%s\"", in_dir (collide[i]));
+  for (i = 0; i < COLLIDE_CNT; i++)
+    check_exists (collide[i], i % 2 != 0);
+  check_readdir (PLAIN_CNT + COLLIDE_CNT / 2);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hash-overflow) begin
+(dir-hash-overflow) mkdir "a"
+(dir-hash-overflow) creating 60 files
+(dir-hash-overflow) creating 30 files whose names hash to one bucket
+(dir-hash-overflow) opening every file
+(dir-hash-overflow) open "a"
+(dir-hash-overflow) read 90 entries
+(dir-hash-overflow) removing every other colliding file
+(dir-hash-overflow) open "a"
+(dir-hash-overflow) read 75 entries
+(dir-hash-overflow) end
+EOF
+pass;
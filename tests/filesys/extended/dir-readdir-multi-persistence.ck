@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"a" => {"f0" => [''], "f1" => [''], "f2" => [''], "f3" => [''], "f4" => [''], "f5" => [''], "f6" => [''], "f7" => [''], "f8" => [''], "f9" => ['']}});
+pass;
@@ -0,0 +1,80 @@
+/* Reads a directory with readdir_multi() in batches smaller
+   than, equal to, and larger than the number of entries, checking
+   that each batch resumes where the last one left off and that
+   every entry is read exactly once.  Then checks that
+   readdir_multi() fails on a file that is not a directory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 10
+
+/* Reads all of directory "a" in batches of BATCH entries and
+   checks that it returns each of the FILE_CNT files once. */
+static void
+read_in_batches (int batch)
+{
+  char names[FILE_CNT + 6][READDIR_MAX_LEN + 1];
+  bool seen[FILE_CNT];
+  int total = 0;
+  int fd, cnt, i;
+
+  msg ("reading \"a\" %d entries at a time", batch);
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  memset (seen, 0, sizeof seen);
+  do
+    {
+      cnt = readdir_multi (fd, names, batch);
+      if (cnt < 0 || cnt > batch)
+        fail ("readdir_multi returned %d for a batch of %d", cnt, batch);
+      if (cnt < batch && total + cnt != FILE_CNT)
+        fail ("readdir_multi returned %d entries after %d, "
+              "but \"a\" holds %d", cnt, total, FILE_CNT);
+      for (i = 0; i < cnt; i++)
+        {
+          int n;
+
+          if (names[i][0] != 'f' || names[i][1] < '0' || names[i][1] > '9'
+              || names[i][2] != '\0')
+            fail ("readdir_multi returned unexpected name \"%s\"", names[i]);
+          n = names[i][1] - '0';
+          if (seen[n])
+            fail ("readdir_multi returned \"%s\" twice", names[i]);
+          seen[n] = true;
+        }
+      total += cnt;
+    }
+  while (cnt == batch);
+  if (readdir_multi (fd, names, batch) != 0)
+    fail ("readdir_multi returned more entries at end of directory");
+  msg ("read %d entries", total);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  char names[1][READDIR_MAX_LEN + 1];
+  char name[] = "a/f0";
+  int fd, i;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  msg ("creating \"a/f0\" through \"a/f9\"");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      name[3] = '0' + i;
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  read_in_batches (3);
+  read_in_batches (FILE_CNT);
+  read_in_batches (FILE_CNT + 6);
+
+  CHECK ((fd = open ("a/f0")) > 1, "open \"a/f0\"");
+  CHECK (readdir_multi (fd, names, 1) == -1,
+         "readdir_multi \"a/f0\" (must return -1)");
+  close (fd);
+}
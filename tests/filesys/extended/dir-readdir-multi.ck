@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-readdir-multi) begin
+(dir-readdir-multi) mkdir "a"
+(dir-readdir-multi) creating "a/f0" through "a/f9"
+(dir-readdir-multi) reading "a" 3 entries at a time
+(dir-readdir-multi) open "a"
+(dir-readdir-multi) read 10 entries
+(dir-readdir-multi) reading "a" 10 entries at a time
+(dir-readdir-multi) open "a"
+(dir-readdir-multi) read 10 entries
+(dir-readdir-multi) reading "a" 16 entries at a time
+(dir-readdir-multi) open "a"
+(dir-readdir-multi) read 10 entries
+(dir-readdir-multi) open "a/f0"
+(dir-readdir-multi) readdir_multi "a/f0" (must return -1)
+(dir-readdir-multi) end
+EOF
+pass;
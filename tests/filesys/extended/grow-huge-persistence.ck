@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($size) = 9 * 1024 * 1024;
+my ($dense) = join ('', map (pack ("V", $_) x 128, 0 .. $size / 512 - 1));
+my ($sparse) = "\0" x $size;
+for (my $ofs = 0; $ofs < $size; $ofs += 64 * 1024) {
+    substr ($sparse, $ofs, 512) = substr ($dense, $ofs, 512);
+}
+check_archive ({"dense" => [$dense], "sparse" => [$sparse]});
+check_fsck ();
+pass;
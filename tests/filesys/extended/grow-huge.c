@@ -0,0 +1,105 @@
+/* Writes two files larger than 8 MB, on a file system big enough
+   to hold them: "dense", written from start to end, and
+   "sparse", which has one sector of data every SPARSE_STRIDE
+   bytes and holes in between, so that it has hundreds of
+   extents, most of them in its extent tree.  Then reads both
+   back.  Each sector of data holds its own sector number,
+   repeated, so that a sector read from the wrong place shows. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (9 * 1024 * 1024)     /* Bytes in each file. */
+#define CHUNK_SIZE 4096                 /* Bytes per read or write. */
+#define SPARSE_STRIDE (64 * 1024)       /* Bytes between data sectors. */
+
+static char buf[CHUNK_SIZE];
+
+/* Fills in BUF with the data for the SIZE bytes that start at
+   byte OFS of a file.  If SPARSE is true, the file is "sparse",
+   which has zeros outside its data sectors. */
+static void
+fill_chunk (int ofs, size_t size, bool sparse)
+{
+  size_t i;
+
+  for (i = 0; i < size; i += sizeof (uint32_t))
+    {
+      uint32_t sector = (ofs + i) / 512;
+      uint32_t value = sector;
+
+      if (sparse && (ofs + i) % SPARSE_STRIDE >= 512)
+        value = 0;
+      *(uint32_t *) (buf + i) = value;
+    }
+}
+
+/* Checks that the file named NAME is FILE_SIZE bytes long and
+   holds the data that fill_chunk() describes. */
+static void
+verify (const char *name, bool sparse)
+{
+  static char actual[CHUNK_SIZE];
+  int ofs;
+  int fd;
+
+  CHECK ((fd = open (name)) > 1, "open \"%s\" for verification", name);
+  if (filesize (fd) != FILE_SIZE)
+    fail ("\"%s\" is %d bytes long, expected %d",
+          name, filesize (fd), FILE_SIZE);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      if (read (fd, actual, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("read %d bytes at offset %d in \"%s\" failed",
+              CHUNK_SIZE, ofs, name);
+      fill_chunk (ofs, CHUNK_SIZE, sparse);
+      if (memcmp (actual, buf, CHUNK_SIZE))
+        fail ("\"%s\" differs from expected near offset %d", name, ofs);
+    }
+  msg ("verified contents of \"%s\"", name);
+  msg ("close \"%s\"", name);
+  close (fd);
+}
+
+void
+test_main (void)
+{
+  int ofs;
+  int fd;
+
+  CHECK (create ("dense", 0), "create \"dense\"");
+  CHECK ((fd = open ("dense")) > 1, "open \"dense\"");
+  msg ("write %d bytes to \"dense\"", FILE_SIZE);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      fill_chunk (ofs, CHUNK_SIZE, false);
+      if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("write %d bytes at offset %d in \"dense\" failed",
+              CHUNK_SIZE, ofs);
+    }
+  msg ("close \"dense\"");
+  close (fd);
+
+  CHECK (create ("sparse", 0), "create \"sparse\"");
+  CHECK ((fd = open ("sparse")) > 1, "open \"sparse\"");
+  msg ("write one sector every %d bytes of \"sparse\"", SPARSE_STRIDE);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += SPARSE_STRIDE)
+    {
+      fill_chunk (ofs, 512, true);
+      seek (fd, ofs);
+      if (write (fd, buf, 512) != 512)
+        fail ("write 512 bytes at offset %d in \"sparse\" failed", ofs);
+    }
+  msg ("extend \"sparse\" to %d bytes", FILE_SIZE);
+  fill_chunk (FILE_SIZE - 4, 4, true);
+  seek (fd, FILE_SIZE - 4);
+  CHECK (write (fd, buf, 4) == 4, "write end of \"sparse\"");
+  msg ("close \"sparse\"");
+  close (fd);
+
+  verify ("dense", false);
+  verify ("sparse", true);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-huge) begin
+(grow-huge) create "dense"
+(grow-huge) open "dense"
+(grow-huge) write 9437184 bytes to "dense"
+(grow-huge) close "dense"
+(grow-huge) create "sparse"
+(grow-huge) open "sparse"
+(grow-huge) write one sector every 65536 bytes of "sparse"
+(grow-huge) extend "sparse" to 9437184 bytes
+(grow-huge) write end of "sparse"
+(grow-huge) close "sparse"
+(grow-huge) open "dense" for verification
+(grow-huge) verified contents of "dense"
+(grow-huge) close "dense"
+(grow-huge) open "sparse" for verification
+(grow-huge) verified contents of "sparse"
+(grow-huge) close "sparse"
+(grow-huge) end
+EOF
+pass;
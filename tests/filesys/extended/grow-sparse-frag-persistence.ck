@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (1400 * 512);
+for (my $i = 65; $i < 1400; $i += 2) {
+    substr ($data, $i * 512, 512) = "\0" x 512;
+}
+check_archive ({"testfile" => [$data]});
+pass;
@@ -0,0 +1,51 @@
+/* Writes every other sector of a file, from its end back to its
+   start, so that each write adds extents ahead of all the others
+   and the file ends up with about 1,400 extents, most of them in
+   its extent tree.  Then fills some of the holes near its
+   start. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Sectors in the file. */
+#define SECTORS 1400
+
+/* Holes filled afterward are in the first FILLED sectors. */
+#define FILLED 64
+
+static char buf[SECTORS * 512];
+
+static void
+write_sector (int fd, int sector)
+{
+  seek (fd, sector * 512);
+  if (write (fd, buf + sector * 512, 512) != 512)
+    fail ("write sector %d failed", sector);
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+  int i;
+
+  random_bytes (buf, sizeof buf);
+  for (i = FILLED + 1; i < SECTORS; i += 2)
+    memset (buf + i * 512, 0, 512);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("write every other sector, backward");
+  for (i = SECTORS - 2; i >= 0; i -= 2)
+    write_sector (fd, i);
+  msg ("fill holes in the first %d sectors", FILLED);
+  for (i = 1; i < FILLED; i += 2)
+    write_sector (fd, i);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse-frag) begin
+(grow-sparse-frag) create "testfile"
+(grow-sparse-frag) open "testfile"
+(grow-sparse-frag) write every other sector, backward
+(grow-sparse-frag) fill holes in the first 64 sectors
+(grow-sparse-frag) close "testfile"
+(grow-sparse-frag) open "testfile" for verification
+(grow-sparse-frag) verified contents of "testfile"
+(grow-sparse-frag) close "testfile"
+(grow-sparse-frag) end
+EOF
+pass;
@@ -313,6 +313,17 @@ EOF
     fail "Extracted file system contents are not correct.\n" if $errors;
 }
 
+# Checks the output of the pintos-fsck run on the disk that the
+# test and the file system extraction run left behind, failing
+# unless it found no problems, such as leaked sectors.
+sub check_fsck {
+    my ($base) = @prereq_tests ? $prereq_tests[0] : $test;
+    my (@output) = read_text_file ("$base-fsck.output");
+    fail join ("\n", "pintos-fsck found problems in the file system:",
+	       @output) . "\n"
+      if !grep (/^0 problems found$/, @output);
+}
+
 # open_file ([$FILE, $OFFSET, $LENGTH])
 # open_file ([$CONTENTS])
 #
@@ -33,7 +33,10 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "devices/block-trace.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -52,6 +55,17 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk, -ramdisk-role, -ramdisk-load: Size in kB of a RAM
+   disk to create, or 0 for none, the role it plays, and the
+   block device to copy into it. */
+static size_t ramdisk_kb;
+static enum block_type ramdisk_role = BLOCK_FILESYS;
+static const char *ramdisk_source;
+
+/* -trace: Number of block requests to keep in the trace, or 0
+   not to trace. */
+static size_t trace_records;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -122,7 +136,11 @@ main (void)
 
 #ifdef FILESYS
   /* Initialize file system. */
+  block_trace_init (trace_records);
   ide_init ();
+  if (ramdisk_kb > 0)
+    ramdisk_init (ramdisk_kb * 1024 / BLOCK_SECTOR_SIZE, ramdisk_role,
+                  ramdisk_source);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -223,6 +241,45 @@ read_command_line (void)
   return argv;
 }
 
+#ifdef FILESYS
+/* Returns the block device role named NAME, which must be
+   "filesys", "scratch", or "swap". */
+static enum block_type
+parse_role (const char *name)
+{
+  enum block_type role;
+
+  for (role = BLOCK_FILESYS; role < BLOCK_ROLE_CNT; role++)
+    if (name != NULL && !strcmp (name, block_type_name (role)))
+      return role;
+  PANIC ("unknown block device role `%s' (use -h for help)", name);
+}
+
+/* Returns VALUE, the argument of option NAME, as a count from 0
+   to MAX.  Unlike atoi(), rejects a negative, missing, or
+   overlarge count instead of letting it wrap around. */
+static size_t
+parse_count (const char *name, const char *value, size_t max)
+{
+  size_t count = 0;
+  const char *p;
+
+  if (value == NULL || *value == '\0')
+    PANIC ("option `%s' requires a count (use -h for help)", name);
+  for (p = value; *p != '\0'; p++)
+    {
+      if (*p < '0' || *p > '9')
+        PANIC ("option `%s' requires a count, not `%s' (use -h for help)",
+               name, value);
+      if (count > (max - (*p - '0')) / 10)
+        PANIC ("option `%s' count `%s' exceeds maximum of %zu",
+               name, value, max);
+      count = count * 10 + (*p - '0');
+    }
+  return count;
+}
+#endif
+
 /* Parses options in ARGV[]
    and returns the first non-option argument. */
 static char **
@@ -247,6 +304,20 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-dma"))
+        ide_dma = true;
+      else if (!strcmp (name, "-flush"))
+        cache_flush_interval = parse_count (name, value, CACHE_FLUSH_MAX);
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = parse_count (name, value, RAMDISK_MAX_KB);
+      else if (!strcmp (name, "-ramdisk-role"))
+        ramdisk_role = parse_role (value);
+      else if (!strcmp (name, "-ramdisk-load"))
+        ramdisk_source = value;
+      else if (!strcmp (name, "-trace"))
+        trace_records = parse_count (name, value, BLOCK_TRACE_MAX);
+      else if (!strcmp (name, "-trace-scratch"))
+        block_trace_scratch = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -373,6 +444,13 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -dma               Transfer data on IDE disks by bus-master DMA.\n"
+          "  -flush=MS          Write back cached sectors every MS ms (0=never).\n"
+          "  -ramdisk=SIZE      Use a SIZE kB RAM disk \"ram0\" as file system.\n"
+          "  -ramdisk-role=ROLE Use the RAM disk as filesys, scratch, or swap.\n"
+          "  -ramdisk-load=BDEV Copy BDEV into the RAM disk during startup.\n"
+          "  -trace=COUNT       Trace the last COUNT block requests.\n"
+          "  -trace-scratch     Write the trace to scratch, not the console.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -391,6 +469,20 @@ usage (void)
 static void
 locate_block_devices (void)
 {
+  /* The RAM disk takes its role unless another device was named
+     for it explicitly. */
+  if (ramdisk_kb > 0)
+    {
+      if (ramdisk_role == BLOCK_FILESYS && filesys_bdev_name == NULL)
+        filesys_bdev_name = "ram0";
+      else if (ramdisk_role == BLOCK_SCRATCH && scratch_bdev_name == NULL)
+        scratch_bdev_name = "ram0";
+#ifdef VM
+      else if (ramdisk_role == BLOCK_SWAP && swap_bdev_name == NULL)
+        swap_bdev_name = "ram0";
+#endif
+    }
+
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
 #ifdef VM
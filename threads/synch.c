@@ -336,3 +336,241 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK.  A reader/writer lock can be held by any
+   number of readers at once, or by a single writer.  Like a lock,
+   it is not recursive: a thread that holds RWLOCK in either mode
+   must not try to acquire it again.
+
+   Writers have preference: once a writer is waiting, new readers
+   wait until it is done, so a steady stream of readers cannot
+   starve writers out.  (Readers can be starved instead, if
+   writers keep coming.)  A reader may also turn its hold into a
+   write hold, with rwlock_upgrade(), and a writer may turn its
+   hold into a read hold, with rwlock_downgrade(). */
+void
+rwlock_init (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->can_read);
+  cond_init (&rwlock->can_write);
+  cond_init (&rwlock->can_upgrade);
+  rwlock->readers = 0;
+  rwlock->waiting_writers = 0;
+  rwlock->upgrading = false;
+  rwlock->writer = NULL;
+}
+
+/* Returns true if a thread that wants to read RWLOCK may do so
+   now.  RWLOCK's lock must be held. */
+static bool
+may_read (const struct rwlock *rwlock)
+{
+  return (rwlock->writer == NULL && rwlock->waiting_writers == 0
+          && !rwlock->upgrading);
+}
+
+/* Returns true if a thread that wants to write RWLOCK may do so
+   now.  RWLOCK's lock must be held. */
+static bool
+may_write (const struct rwlock *rwlock)
+{
+  return (rwlock->writer == NULL && rwlock->readers == 0
+          && !rwlock->upgrading);
+}
+
+/* Wakes up the threads that may now enter RWLOCK, which no
+   thread is writing: an upgrading reader once it is the only
+   reader, otherwise one writer once there are no readers, or
+   else all the waiting readers.  RWLOCK's lock must be held. */
+static void
+wake_waiters (struct rwlock *rwlock)
+{
+  ASSERT (rwlock->writer == NULL);
+
+  if (rwlock->upgrading)
+    {
+      if (rwlock->readers == 1)
+        cond_signal (&rwlock->can_upgrade, &rwlock->lock);
+    }
+  else if (rwlock->waiting_writers > 0)
+    {
+      if (rwlock->readers == 0)
+        cond_signal (&rwlock->can_write, &rwlock->lock);
+    }
+  else
+    cond_broadcast (&rwlock->can_read, &rwlock->lock);
+}
+
+/* Acquires RWLOCK for reading, sleeping until no thread is
+   writing it or waiting to.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  while (!may_read (rwlock))
+    cond_wait (&rwlock->can_read, &rwlock->lock);
+  rwlock->readers++;
+  lock_release (&rwlock->lock);
+}
+
+/* Tries to acquire RWLOCK for reading and returns true if
+   successful or false on failure.  Does not sleep, except
+   briefly on RWLOCK's internal lock. */
+bool
+rwlock_try_acquire_read (struct rwlock *rwlock)
+{
+  bool success;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  success = may_read (rwlock);
+  if (success)
+    rwlock->readers++;
+  lock_release (&rwlock->lock);
+  return success;
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading. */
+void
+rwlock_release_read (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->readers > 0);
+  rwlock->readers--;
+  wake_waiters (rwlock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread is
+   reading or writing it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->waiting_writers++;
+  while (!may_write (rwlock))
+    cond_wait (&rwlock->can_write, &rwlock->lock);
+  rwlock->waiting_writers--;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+}
+
+/* Tries to acquire RWLOCK for writing and returns true if
+   successful or false on failure.  Does not sleep, except
+   briefly on RWLOCK's internal lock. */
+bool
+rwlock_try_acquire_write (struct rwlock *rwlock)
+{
+  bool success;
+
+  ASSERT (rwlock != NULL);
+  ASSERT (!rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  success = may_write (rwlock);
+  if (success)
+    rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+  return success;
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing. */
+void
+rwlock_release_write (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer = NULL;
+  wake_waiters (rwlock);
+  lock_release (&rwlock->lock);
+}
+
+/* Turns the current thread's read hold on RWLOCK into a write
+   hold, sleeping until the other readers have left.  An
+   upgrading reader goes ahead of waiting writers, so that the
+   data it read is still current when it starts writing.
+
+   Only one reader can upgrade at a time: two readers waiting
+   for each other to leave would deadlock.  So if another reader
+   is already upgrading, returns false at once, and the current
+   thread still holds RWLOCK for reading; it must release it
+   before it can acquire RWLOCK for writing, and must then check
+   again anything it read.  Otherwise returns true.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+rwlock_upgrade (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->readers > 0);
+  if (rwlock->upgrading)
+    {
+      lock_release (&rwlock->lock);
+      return false;
+    }
+  rwlock->upgrading = true;
+  while (rwlock->readers > 1)
+    cond_wait (&rwlock->can_upgrade, &rwlock->lock);
+  rwlock->upgrading = false;
+  rwlock->readers = 0;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+  return true;
+}
+
+/* Turns the current thread's write hold on RWLOCK into a read
+   hold, letting waiting readers in along with it unless a writer
+   is waiting too.  Unlike releasing RWLOCK and acquiring it
+   again, no writer can get in between. */
+void
+rwlock_downgrade (struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer = NULL;
+  rwlock->readers = 1;
+  wake_waiters (rwlock);
+  lock_release (&rwlock->lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing,
+   false otherwise.  (Whether the current thread holds it for
+   reading is not recorded.) */
+bool
+rwlock_held_for_write (const struct rwlock *rwlock)
+{
+  ASSERT (rwlock != NULL);
+
+  return rwlock->writer == thread_current ();
+}
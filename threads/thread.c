@@ -477,6 +477,8 @@ init_thread (struct thread *t, const char *name, int priority)
 	sema_init(&t->dead_lock,0);
 	sema_init(&t->wait_lock,0);
   t->currentDir=NULL;
+  t->journal_depth = 0;
+  t->journal_slots = 0;
 t->magic = THREAD_MAGIC;
 
 
@@ -106,6 +106,8 @@ struct thread
 	struct semaphore dead_lock;
 	struct file* myFile;
   struct dir* currentDir;
+  int journal_depth;                  /* Nesting of journal_begin(). */
+  size_t journal_slots;               /* Journal slots reserved. */
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
@@ -16,10 +16,10 @@
 #include "filesys/directory.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "devices/block.h"
 #define EOF -1
-
-static struct lock l;
-
+//most block devices whose statistics one blockstats call returns
+#define BLOCKSTATS_MAX 64
 
 bool valid_pointer(void* ptr, struct intr_frame* f){
 	struct thread* t = thread_current();
@@ -42,7 +42,6 @@ static void syscall_handler (struct intr_frame *);
 void
 syscall_init (void) {
 	intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-	lock_init(&l);
 }
 
 //Terminates Pintos by calling shutdown_power_off() (declared in threads/init.h). This should be seldom used, because you lose some information about possible deadlock situations, etc.
@@ -91,27 +90,24 @@ int wait (tid_t pid) {
 	return process_wait(pid);
 }
 
+//There is no lock around the file system calls below: the file system locks each inode,
+//directory and the free map itself, so processes doing independent I/O run concurrently.
+
 //Creates a new file called file initially initial_size bytes in size. Returns true if successful, false otherwise. Creating a new file does not open it: opening the new file is a separate operation which would require a open system call.
 bool create (const char *file, unsigned initial_size) {
-	lock_acquire(&l);
 	/*if(strlen(file)>14){
-		lock_release(&l);
 		return false;
 	}*/
 	bool ret = filesys_create(file,initial_size,false);
-	lock_release(&l);
 	return ret;
 }
 
 //Deletes the file called file. Returns true if successful, false otherwise. A file may be removed regardless of whether it is open or closed, and removing an open file does not close it. See Removing an Open File, for details.
 bool remove (const char *file) {
-	lock_acquire(&l);
 	/*if(strlen(file)>14){
-		lock_release(&l);
 		return false;
 	}*/
 	bool ret = filesys_remove(file);
-	lock_release(&l);
 	return ret;
 }
 
@@ -123,9 +119,7 @@ Each process has an independent set of file descriptors. File descriptors are no
 When a single file is opened more than once, whether by a single process or different processes, each open returns a new file descriptor. Different file descriptors for a single file are closed independently in separate calls to close and they do not share a file position.
 */
 int open (const char *file) {
-	lock_acquire(&l);
 	//if(strlen(file)>14){
-	//	lock_release(&l);
 	//	return -1;
 	//}
 	struct file* filePt = filesys_open(file);
@@ -135,35 +129,28 @@ int open (const char *file) {
 		for(i = 2; i < thread->fileTableSz; i++){
 			if(thread->fileTable[i] == NULL){
 				thread->fileTable[i]=filePt;
-				lock_release(&l);
 				return i;
 			}
 		}
 	}
-	lock_release(&l);
 	return -1;	
 	
 }
 
 //Returns the size, in bytes, of the file open as fd.
 int filesize (int fd) {
-	lock_acquire(&l);
 	struct thread* thread= thread_current();
 	if(fd < 0 || fd > thread->fileTableSz){
-		lock_release(&l);
 		return -1;
 	}
 	struct file* file=thread->fileTable[fd];
 	int ret = file_length(file);
-	lock_release(&l);
 	return ret;
 }
 
 //Reads size bytes from the file open as fd into buffer. Returns the number of bytes actually read (0 at end of file), or -1 if the file could not be read (due to a condition other than end of file). Fd 0 reads from the keyboard using input_getc().
 int read (int fd, void *buffer, unsigned size) {
-	lock_acquire(&l);
 	if(size == 0){
-			lock_release(&l);
 			return 0;
 	}
 	int bytes = 0;
@@ -176,7 +163,6 @@ int read (int fd, void *buffer, unsigned size) {
 			char byte = input_getc();
 			if(byte == EOF){
 				read_buffer[i] =NULL;
-				lock_release(&l);
 				return i;
 			}
 			read_buffer[i] = byte;
@@ -186,17 +172,14 @@ int read (int fd, void *buffer, unsigned size) {
 	} else{
 		struct thread* thread= thread_current();
 		if(fd < 0 || fd > thread->fileTableSz){
-			lock_release(&l);
 			return -1;
 		}	
 		struct file* file=thread->fileTable[fd];
 		if(file==NULL){
-			lock_release(&l);
 			return -1;
 		}
 		bytes=(int)file_read(file, buffer,size);
 	}
-	lock_release(&l);
 	return bytes;
 }
 
@@ -206,9 +189,7 @@ Writing past end-of-file would normally extend the file, but file growth is not
 Fd 1 writes to the console. Your code to write to the console should write all of buffer in one call to putbuf(), at least as long as size is not bigger than a few hundred bytes. (It is reasonable to break up larger buffers.) Otherwise, lines of text output by different processes may end up interleaved on the console, confusing both human readers and our grading scripts.
 */
 int write (int fd, const void *buffer, unsigned size) {
-	lock_acquire(&l);
 	if(size == 0){
-		lock_release(&l);
 		return 0;
 	}
 	int bytes = 0;
@@ -221,21 +202,17 @@ int write (int fd, const void *buffer, unsigned size) {
 	} else {
 		struct thread* thread= thread_current();
 		if(fd < 0 || fd > thread->fileTableSz){
-			lock_release(&l);
 			return -1;
 		}
 		struct file* file= thread->fileTable[fd];
 		if(file->inode->data.isdir==true){
-			lock_release(&l);
 			return -1;
 		}
 		if(file==NULL){
-			lock_release(&l);
 			return -1;
 		}
 		bytes=file_write(file,buffer,size);
 	}
-	lock_release(&l);
 	return bytes;
 }
 
@@ -243,118 +220,52 @@ int write (int fd, const void *buffer, unsigned size) {
 A seek past the current end of a file is not an error. A later read obtains 0 bytes, indicating end of file. A later write extends the file, filling any unwritten gap with zeros. (However, in Pintos files have a fixed length until project 4 is complete, so writes past end of file will return an error.) These semantics are implemented in the file system and do not require any special effort in system call implementation.
 */
 void seek (int fd, unsigned position) {
-	lock_acquire(&l);
 	struct thread* thread= thread_current();
     struct file* file=thread->fileTable[fd];
 	file_seek(file, (off_t) position);
-	lock_release(&l);
 }
 
 //Returns the position of the next byte to be read or written in open file fd, expressed in bytes from the beginning of the file.
 unsigned tell (int fd) {
-	lock_acquire(&l);
 	struct thread* thread= thread_current();
 	struct file* file=thread->fileTable[fd];
 	unsigned ret = file_tell(file);	
-	lock_release(&l);
 	return ret;
 }
 
 //Closes file descriptor fd. Exiting or terminating a process implicitly closes all its open file descriptors, as if by calling this function for each one.
 void close (int fd) {
 	if(fd<=1){return;}
-	lock_acquire(&l);
 	struct thread* thread= thread_current();
 	struct file* file = thread->fileTable[fd];
 	if(file==NULL){
-		lock_release(&l);
 		return;
 	}
 	thread->fileTable[fd]=NULL;
 	if(file->inode->data.isdir==false){
 		file_close(file);
-		lock_release(&l);
 	}
 	else{
 		dir_close((struct dir*)file);
-		lock_release(&l);
 	}
 }
 /* Changes the current working directory of the process to dir, which may be relative or absolute. 
 Returns true if successful, false on failure. */
 bool chdir (const char *dir){
-	int i=0;
-	if(dir[i]==NULL){return false;}
-	//moving a directory that is inside our current directory//
-	struct thread* t= thread_current();
-	struct dir* currentDir=NULL;
-  	if(dir[i]!='/' && t->currentDir!=NULL){
-  	  currentDir=t->currentDir;
-  	}
-  	else if(dir[i]=='/'){
-  		currentDir=dir_open_root();
-		i++;
-	}
-	//moving to the root first and then look for directory//
-	else {
-		currentDir=dir_open_root();
-	}
-	char* file =(char*)calloc(sizeof(char), strlen(dir));
-	struct inode* currentInode;
-	int k=0;
-	bool finalDir=false;
-	while(dir[i]!=NULL){
-		if(dir[i]=='.' && dir[i+1]=='.'){
-				i=i+2;
-				k+=3;
-				file[0]='.';
-				file[1]='.';
-				file[2] = NULL;
-				dir_lookup (currentDir, file,&currentInode);
-				if(currentInode==NULL){return false;}
-				currentDir=dir_open(currentInode);
-				if(currentDir==NULL){return false;}
-				if(dir[i+2] != '/'){
-					break;
-				}
-
-		}
-		else if (dir[i]=='/'){
-				file[k]=0;
-				dir_lookup (currentDir, file,&currentInode);
-				if(currentInode==NULL){return false;}
-				currentDir=dir_open(currentInode);
-				if(currentDir==NULL){return false;}
-				k=0;
-				finalDir=false;
-			i++;
-		}
-		else{
-			finalDir=true;
-			file[k]=dir[i];
-			i++;
-			k++;
-		}	
-	}
-	file[k]=0;
-	if(finalDir==true){
-		if(!dir_lookup (currentDir, file,&currentInode)) return false;
-		if(currentInode==NULL){return false;}
-		currentDir=dir_open(currentInode);
-		if(currentDir==NULL){return false;}
+	struct dir* newDir = filesys_open_dir(dir);
+	if(newDir == NULL){
+		return false;
 	}
-	t->currentDir=currentDir; 	//should be reopen???
-	close(currentDir);
+	struct thread* t = thread_current();
+	dir_close(t->currentDir);
+	t->currentDir = newDir;
 	return true;
-
 }
 /*Creates the directory named dir, which may be relative or absolute. Returns true if successful,
  false on failure. Fails if dir already exists or if any directory name in dir, besides the last,
   does not already exist. That is, mkdir("/a/b/c") succeeds only if "/a/b" already exists and "/a/b/c" does not. */
 bool mkdir (const char *dir){
-	lock_acquire(&l);
 	bool ret = filesys_create(dir,0,true);
-	lock_release(&l);
 	return ret;
 }
 /*Reads a directory entry from file descriptor fd, which must represent a directory. If successful, stores the null-terminated
@@ -364,12 +275,10 @@ at all or to be read multiple times. Otherwise, each directory entry should be r
 If your file system supports longer file names than the basic file system, you should increase this value from the default of 14.*/
 bool readdir (int fd, char *name){
 	if(fd<=1){return false;}
- 	lock_acquire(&l);
  	struct thread* t= thread_current();
  	struct dir* dir=(struct dir*)t->fileTable[fd];
  	if(dir->inode->data.isdir==false){return false;}
  	bool ret = dir_readdir(dir,name);
- 	lock_release(&l);
  	return ret;
  	//need to check if this is the correct way to check if the returned file is the same as the root or the current dir
  	//if(strcmp(name,".")==0){return false;}
@@ -377,17 +286,28 @@ bool readdir (int fd, char *name){
 
 
 
+}
+/*Reads up to cnt entries from directory fd into names, each of which has room for
+NAME_MAX + 1 bytes, and returns the number read, which is less than cnt only at the end
+of the directory, or -1 if fd is not a directory. Lets ls-style programs read a whole
+directory in a few calls instead of one per entry.*/
+int readdir_multi (int fd, char names[][NAME_MAX + 1], int cnt){
+	if(fd<=1){return -1;}
+	struct thread* t= thread_current();
+	struct file* file=t->fileTable[fd];
+	if(file==NULL || file->inode->data.isdir==false){
+		return -1;
+	}
+	int ret = dir_readdir_multi((struct dir*)file,names,cnt);
+	return ret;
 }
 /*    Returns true if fd represents a directory, false if it represents an ordinary file.*/
  bool isdir (int fd){
  	if(fd<=1){return false;}
- 	lock_acquire(&l);
  	struct thread* t= thread_current();
  	if (t->fileTable[fd]->inode->data.isdir==true){
- 		lock_release(&l);
  		return true;
  	}
- 	lock_release(&l);
  	return false;
 
 
@@ -397,12 +317,16 @@ bool readdir (int fd, char *name){
   the sector number of the inode is suitable for use as an inode number.*/
 int inumber (int fd){
  	if(fd<=1){return -1;}
- 	lock_acquire(&l);
  	struct thread* t= thread_current();
  	int ret = t->fileTable[fd]->inode->sector;
- 	lock_release(&l);
  	return ret;
 }
+/*Copies the statistics of up to cnt block devices into stats, in the order the devices
+were registered, and returns the number of block devices, which may be more than cnt.
+Lets iostat-style programs see request sizes, sequentiality and latency without a reboot.*/
+int blockstats (struct block_stats *stats, int cnt){
+	return (int) block_get_stats(stats, cnt);
+}
 
 
 
@@ -585,6 +509,34 @@ syscall_handler (struct intr_frame *f) {
 			}
 			f->eax = (uint32_t) readdir (fd,(const char*)buffer);
 			break;
+    	case SYS_READDIR_MULTI:
+			fd = *sp;
+			if(fd < 0 || fd > thread->fileTableSz){
+				f->eax = -1;
+				return;
+			}
+			sp++;
+			buffer = (char*) *sp;
+			sp++;
+			size = *sp;
+			//at most PGSIZE names per call, and every page of the names
+			//array must be mapped, not just the first
+			if((int) size < 0 || size > PGSIZE){
+				f->eax = -1;
+				return;
+			}
+			for(position = 0; position < size * (NAME_MAX + 1); position += PGSIZE){
+				if(!valid_pointer((char*)buffer + position, f)){
+					exit(-1);
+					return;
+				}
+			}
+			if(size > 0 && !valid_pointer((char*)buffer + size * (NAME_MAX + 1) - 1, f)){
+				exit(-1);
+				return;
+			}
+			f->eax = (uint32_t) readdir_multi (fd,(char (*)[NAME_MAX + 1])buffer,size);
+			break;
     	case SYS_ISDIR:
     		fd=*sp;
     		if(fd < 0 || fd > thread->fileTableSz){
@@ -601,6 +553,27 @@ syscall_handler (struct intr_frame *f) {
 			}
 			f->eax = inumber(fd);
 			break;
+    	case SYS_BLOCKSTATS:
+			buffer = (char*) *sp;
+			sp++;
+			size = *sp;
+			//every page of the stats array must be mapped, as for readdir_multi
+			if((int) size < 0 || size > BLOCKSTATS_MAX){
+				f->eax = -1;
+				return;
+			}
+			for(position = 0; position < size * sizeof (struct block_stats); position += PGSIZE){
+				if(!valid_pointer((char*)buffer + position, f)){
+					exit(-1);
+					return;
+				}
+			}
+			if(size > 0 && !valid_pointer((char*)buffer + size * sizeof (struct block_stats) - 1, f)){
+				exit(-1);
+				return;
+			}
+			f->eax = (uint32_t) blockstats ((struct block_stats *) buffer, size);
+			break;
 		default:
 			f->eax = -1;
 			break;
@@ -1,6 +1,8 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 #include "threads/thread.h"
+#include "filesys/directory.h"
+#include <block-stats.h>
 
 void syscall_init (void);
 void halt (void);
@@ -20,7 +22,9 @@ bool valid_pointer(void* ptr, struct intr_frame* f);
 bool chdir (const char *dir);
 bool mkdir (const char *dir);
 bool readdir (int fd, char *name);
+int readdir_multi (int fd, char names[][NAME_MAX + 1], int cnt);
 bool isdir (int fd);
 int inumber (int fd);
+int blockstats (struct block_stats *stats, int cnt);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,519 @@
+# Helpers for host-side tools that read and create Pintos file system
+# images.
+#
+# The layout here must match filesys/filesys.h, filesys/inode.h,
+# filesys/directory.c, filesys/free-map.c, and filesys/journal.c.
+
+use strict;
+use warnings;
+use Fcntl 'SEEK_SET';
+
+our $SECTOR_SIZE = 512;
+
+# Fixed sectors.
+our $FREE_MAP_SECTOR = 0;	# Free map file inode.
+our $ROOT_DIR_SECTOR = 1;	# Root directory inode.
+our $JOURNAL_SECTOR = 2;	# Journal header, followed by its log.
+
+# Inodes.
+our $INODE_MAGIC = 0x494e4f44;
+our $INODE_EXTENTS = 61;	# Extents in the inode itself.
+our $LEAF_EXTENTS = 64;		# Extents in an extent tree leaf.
+our $INDEX_LEAVES = 64;		# Leaves in an extent tree index.
+
+# Directories.
+our $DIR_MAGIC = 0x44495248;
+our $DIR_MAX_DEPTH = 7;		# Most hash bits used.
+our $BUCKET_ENTRIES = 25;	# Entries per bucket sector.
+our $NAME_MAX = 14;		# Longest file name component.
+
+# Journal.
+our $JOURNAL_MAGIC = 0x4c4e524a;
+our $JOURNAL_SLOTS = 32;	# Log sectors for the cache, besides the free map.
+our $JOURNAL_LOG_MAX = 122;	# Most sectors in the log.
+
+# The open image.
+our ($fs_name);			# File name, for error messages.
+our ($fs_handle);		# File handle.
+our ($fs_start);		# Sector offset of the file system in the file.
+our ($fs_sectors);		# Size of the file system in sectors.
+our (%fs_overlay);		# Maps sectors to contents that replace them.
+
+# fs_open($file, $writable)
+#
+# Opens the file system in $file, which is either a partitioned
+# disk with a file system partition or a file system partition by
+# itself, for reading and, if $writable, writing.
+sub fs_open {
+    my ($file, $writable) = @_;
+
+    open ($fs_handle, $writable ? '+<' : '<', $file)
+      or die "$file: open: $!\n";
+    binmode ($fs_handle);
+    $fs_name = $file;
+    %fs_overlay = ();
+
+    my ($mbr) = read_mbr ($file);
+    my (%parts) = $mbr ? interpret_partition_table ($mbr, $file) : ();
+    if (exists $parts{FILESYS}) {
+	$fs_start = $parts{FILESYS}{START};
+	$fs_sectors = $parts{FILESYS}{SECTORS};
+    } elsif ($mbr) {
+	die "$file: partitioned disk without a file system partition\n";
+    } else {
+	$fs_start = 0;
+	$fs_sectors = int ((-s $fs_handle) / $SECTOR_SIZE);
+    }
+    die "$file: file system is too small\n" if $fs_sectors < 3;
+}
+
+# fs_read_sector($sector)
+#
+# Returns the contents of $sector of the file system.
+sub fs_read_sector {
+    my ($sector) = @_;
+    return $fs_overlay{$sector} if exists $fs_overlay{$sector};
+
+    die "$fs_name: sector $sector is past end of file system\n"
+      if $sector >= $fs_sectors;
+    sysseek ($fs_handle, ($fs_start + $sector) * $SECTOR_SIZE, SEEK_SET)
+      or die "$fs_name: seek: $!\n";
+    return read_fully ($fs_handle, $fs_name, $SECTOR_SIZE);
+}
+
+# fnv_hash($bytes)
+#
+# Returns the 32-bit Fowler-Noll-Vo hash of $bytes, as computed
+# by hash_bytes() and hash_string() in lib/kernel/hash.c.
+sub fnv_hash {
+    my ($hash) = 2166136261;
+    foreach my $byte (unpack ('C*', $_[0])) {
+	$hash = (($hash * 16777619) & 0xffffffff) ^ $byte;
+    }
+    return $hash;
+}
+
+# fs_read_inode($sector)
+#
+# Reads the inode in $sector and returns it as a hash with keys
+# SECTOR, MAGIC, LENGTH, ISDIR, PARENT, EXTENT_CNT, INDEX, and
+# INODE_EXTENTS, a reference to the [START, LENGTH] extents stored
+# in the inode itself.  Does not check it for validity.
+sub fs_read_inode {
+    my ($sector) = @_;
+    my (@f) = unpack ("V122 V V V C x3 V V", fs_read_sector ($sector));
+    my (@extents) = map ([@f[2 * $_, 2 * $_ + 1]], 0...$INODE_EXTENTS - 1);
+    my ($length) = $f[124] >= 2**31 ? $f[124] - 2**32 : $f[124];
+    return {SECTOR => $sector,
+	    INODE_EXTENTS => \@extents,
+	    EXTENT_CNT => $f[122],
+	    INDEX => $f[123],
+	    LENGTH => $length,
+	    ISDIR => $f[125],
+	    PARENT => $f[126],
+	    MAGIC => $f[127]};
+}
+
+# fs_inode_extents($inode)
+#
+# Returns $inode's extents, as [START, LENGTH] pairs, reading its
+# extent tree if it has one.  A START of 0 is a hole.  Stores the
+# tree's sectors, index first, in $inode->{TREE}, and the extents
+# in $inode->{EXTENTS}.  The tree's sectors include every leaf in
+# the index, since leaves are allocated ahead of use and kept
+# until the inode is deleted; the first $inode->{LEAVES} of them
+# hold extents, packed at the start of each leaf and followed by
+# empty slots of length 0.  Stores the number of sectors that
+# each of those leaves covers in $inode->{LEAF_SECTORS}.  Dies if
+# the tree is damaged.
+sub fs_inode_extents {
+    my ($inode) = @_;
+    return @{$inode->{EXTENTS}} if exists $inode->{EXTENTS};
+
+    my ($cnt) = $inode->{EXTENT_CNT};
+    my ($max) = $INODE_EXTENTS + $INDEX_LEAVES * $LEAF_EXTENTS;
+    die "inode $inode->{SECTOR}: $cnt extents, more than $max\n"
+      if $cnt > $max;
+
+    my (@extents) = @{$inode->{INODE_EXTENTS}};
+    splice (@extents, $cnt) if $cnt < $INODE_EXTENTS;
+    my ($left) = $cnt > $INODE_EXTENTS ? $cnt - $INODE_EXTENTS : 0;
+    $inode->{TREE} = [];
+    $inode->{LEAF_SECTORS} = [];
+    $inode->{LEAVES} = int (($left + $LEAF_EXTENTS - 1) / $LEAF_EXTENTS);
+
+    my ($index) = $inode->{INDEX};
+    if ($index == 0) {
+	die "inode $inode->{SECTOR}: $cnt extents, but no extent tree\n"
+	  if $left > 0;
+	$inode->{EXTENTS} = \@extents;
+	return @extents;
+    }
+    die "inode $inode->{SECTOR}: extent tree index $index is not on disk\n"
+      if $index >= $fs_sectors;
+    push (@{$inode->{TREE}}, $index);
+
+    my (@index) = unpack ('V*', fs_read_sector ($index));
+    for my $leaf (0...$INDEX_LEAVES - 1) {
+	my ($sector) = $index[2 * $leaf];
+	die "inode $inode->{SECTOR}: extent tree leaf $leaf "
+	  . "in sector $sector is not on disk\n"
+	  if ($sector == 0 && $leaf < $inode->{LEAVES})
+	    || $sector >= $fs_sectors;
+	next if $sector == 0;
+	push (@{$inode->{TREE}}, $sector);
+	next if $leaf >= $inode->{LEAVES};
+
+	my (@e) = unpack ('V*', fs_read_sector ($sector));
+	my ($n) = $left < $LEAF_EXTENTS ? $left : $LEAF_EXTENTS;
+	my ($sum) = 0;
+	foreach my $i (0...$n - 1) {
+	    last if $e[2 * $i + 1] == 0;
+	    push (@extents, [@e[2 * $i, 2 * $i + 1]]);
+	    $sum += $e[2 * $i + 1];
+	}
+	push (@{$inode->{LEAF_SECTORS}}, $sum);
+	$left -= $LEAF_EXTENTS;
+    }
+    $inode->{EXTENTS} = \@extents;
+    return @extents;
+}
+
+# fs_read_data($inode, $offset, $size)
+#
+# Reads $size bytes starting at byte $offset in $inode's data and
+# returns them, or fewer if the data ends first.  Holes read as
+# zeros.
+sub fs_read_data {
+    my ($inode, $offset, $size) = @_;
+    my ($length) = $inode->{LENGTH};
+    $size = $length - $offset if $offset + $size > $length;
+    return '' if $size <= 0;
+
+    my (@extents) = fs_inode_extents ($inode);
+    my ($first) = int ($offset / $SECTOR_SIZE);
+    my ($last) = int (($offset + $size - 1) / $SECTOR_SIZE);
+    my ($data) = '';
+    my ($base) = 0;
+    foreach my $e (@extents) {
+	my ($start, $cnt) = @$e;
+	if ($base + $cnt <= $first) {
+	    $base += $cnt;
+	    next;
+	}
+	for (my $i = 0; $i < $cnt; $i++) {
+	    my ($idx) = $base + $i;
+	    next if $idx < $first;
+	    last if $idx > $last;
+	    $data .= $start ? fs_read_sector ($start + $i)
+			    : "\0" x $SECTOR_SIZE;
+	}
+	$base += $cnt;
+	last if $base > $last;
+    }
+    $data .= "\0" x (($last - $first + 1) * $SECTOR_SIZE - length ($data));
+    return substr ($data, $offset % $SECTOR_SIZE, $size);
+}
+
+# fs_read_dir($inode)
+#
+# Reads the directory in $inode and returns it as a hash with
+# keys MAGIC, DEPTH, BUCKET_CNT, ENTRY_CNT, TABLE, a reference to
+# the bucket table, BUCKETS, a reference to an array that maps
+# bucket numbers to hashes with keys DEPTH, NEXT, and ENTRIES, and
+# ENTRIES, a reference to every entry in use.  Each entry is a hash
+# with keys NAME, SECTOR, and BUCKET.  Buckets past the end of the
+# directory are left out.
+sub fs_read_dir {
+    my ($inode) = @_;
+    my ($header) = fs_read_data ($inode, 0, $SECTOR_SIZE);
+    $header .= "\0" x ($SECTOR_SIZE - length ($header));
+
+    my ($magic, $depth, $bucket_cnt, $entry_cnt, @table)
+      = unpack ('V4 v' . 2**$DIR_MAX_DEPTH, $header);
+    my (%dir) = (MAGIC => $magic,
+		 DEPTH => $depth,
+		 BUCKET_CNT => $bucket_cnt,
+		 ENTRY_CNT => $entry_cnt,
+		 TABLE => \@table,
+		 BUCKETS => [],
+		 ENTRIES => []);
+    return \%dir if $magic != $DIR_MAGIC;
+
+    my ($have) = int (($inode->{LENGTH} + $SECTOR_SIZE - 1) / $SECTOR_SIZE);
+    for my $b (1...$bucket_cnt) {
+	last if $b >= $have;
+	my ($depth, $next, undef, @slots)
+	  = unpack ('V3 (V Z15 C)' . $BUCKET_ENTRIES,
+		    fs_read_data ($inode, $b * $SECTOR_SIZE, $SECTOR_SIZE));
+	my (@entries);
+	while (my ($sector, $name, $in_use) = splice (@slots, 0, 3)) {
+	    push (@entries, {NAME => $name, SECTOR => $sector, BUCKET => $b})
+	      if $in_use;
+	}
+	$dir{BUCKETS}[$b] = {DEPTH => $depth, NEXT => $next,
+			     ENTRIES => \@entries};
+	push (@{$dir{ENTRIES}}, @entries);
+    }
+    return \%dir;
+}
+
+# fs_lookup($path)
+#
+# Returns the inode sector for absolute or root-relative $path, or
+# undef if it does not exist.
+sub fs_lookup {
+    my ($path) = @_;
+    my ($sector) = $ROOT_DIR_SECTOR;
+    foreach my $name (grep ($_ ne '' && $_ ne '.', split ('/', $path))) {
+	my ($inode) = fs_read_inode ($sector);
+	return undef if !$inode->{ISDIR} || $inode->{MAGIC} != $INODE_MAGIC;
+	if ($name eq '..') {
+	    $sector = $inode->{PARENT} if $sector != $ROOT_DIR_SECTOR;
+	    next;
+	}
+	my ($e) = grep ($_->{NAME} eq $name,
+			@{fs_read_dir ($inode)->{ENTRIES}});
+	return undef if !defined $e;
+	$sector = $e->{SECTOR};
+    }
+    return $sector;
+}
+
+# fs_read_free_map()
+#
+# Returns the free map as a string with one bit per sector, in the
+# order used by vec().
+sub fs_read_free_map {
+    my ($inode) = fs_read_inode ($FREE_MAP_SECTOR);
+    die "$fs_name: free map inode is damaged\n"
+      if $inode->{MAGIC} != $INODE_MAGIC;
+    return fs_read_data ($inode, 0, $inode->{LENGTH});
+}
+
+# fs_free_map_sectors($sectors)
+#
+# Returns the number of sectors in the free map file of a file
+# system of $sectors sectors.
+sub fs_free_map_sectors {
+    my ($sectors) = @_;
+    my ($bits) = $SECTOR_SIZE * 8;
+    return int (($sectors + $bits - 1) / $bits);
+}
+
+# fs_read_journal()
+#
+# Returns the journal header as a hash with keys MAGIC, COMMITTED,
+# SEQ, CNT, CHECKSUM, SLOTS, the number of sectors in the log,
+# HOMES, a reference to the sectors that the first CNT logged
+# sectors belong in, and VALID, true if the journal holds a
+# committed transaction that matches its checksum, in which case
+# LOG holds the logged sectors.
+sub fs_read_journal {
+    my ($magic, $committed, $seq, $cnt, $checksum, @homes)
+      = unpack ("V5 V$JOURNAL_LOG_MAX V", fs_read_sector ($JOURNAL_SECTOR));
+    my ($slots) = pop (@homes);
+    my (%j) = (MAGIC => $magic, COMMITTED => $committed, SEQ => $seq,
+	       CNT => $cnt, CHECKSUM => $checksum, SLOTS => $slots,
+	       HOMES => \@homes, VALID => 0);
+    if ($magic == $JOURNAL_MAGIC && $committed && $cnt <= $slots
+	&& $slots <= $JOURNAL_LOG_MAX) {
+	splice (@homes, $cnt);
+	my ($log) = join ('', map (fs_read_sector ($JOURNAL_SECTOR + 1 + $_),
+				   0...$cnt - 1));
+	$j{LOG} = $log;
+	$j{VALID} = (fnv_hash (pack ('V*', @homes)) ^ fnv_hash ($log))
+		    == $checksum;
+    }
+    return \%j;
+}
+
+# fs_replay_journal($journal)
+#
+# Makes the sectors in $journal, as returned by fs_read_journal(),
+# replace their homes for later reads, as replaying the journal at
+# boot would.
+sub fs_replay_journal {
+    my ($j) = @_;
+    for my $i (0...$j->{CNT} - 1) {
+	$fs_overlay{$j->{HOMES}[$i]}
+	  = substr ($j->{LOG}, $i * $SECTOR_SIZE, $SECTOR_SIZE);
+    }
+}
+
+# fs_write_sector($handle, $file, $start, $sector, $data)
+#
+# Writes $data, which must be one sector long, to $sector of the
+# file system that starts at sector $start of $file, open as
+# $handle.
+sub fs_write_sector {
+    my ($handle, $file, $start, $sector, $data) = @_;
+    die if length ($data) != $SECTOR_SIZE;
+    sysseek ($handle, ($start + $sector) * $SECTOR_SIZE, SEEK_SET)
+      or die "$file: seek: $!\n";
+    write_fully ($handle, $file, $data);
+}
+
+# fs_pack_inode(%inode)
+#
+# Returns an inode sector for a file LENGTH bytes long whose data
+# is the SECTORS sectors starting at START, with keys ISDIR and
+# PARENT as in fs_read_inode().
+sub fs_pack_inode {
+    my (%inode) = @_;
+    my (@extents) = $inode{SECTORS} ? ($inode{START}, $inode{SECTORS}) : ();
+    return pack ("V122 V V V C x3 V V",
+		 @extents, (0) x (2 * $INODE_EXTENTS - @extents),
+		 @extents / 2, 0, $inode{LENGTH}, $inode{ISDIR} ? 1 : 0,
+		 $inode{PARENT} || 0, $INODE_MAGIC);
+}
+
+# fs_pack_dir(@entries)
+#
+# Returns the data for a directory that holds @entries, each a
+# [NAME, SECTOR] pair, as dir_create() and dir_add() would leave
+# it: a header, then a bucket for each hash value, using as few
+# hash bits as give each bucket room for its entries and at least
+# as many as dir_create() would for a directory of 16 entries,
+# then any overflow buckets.
+sub fs_pack_dir {
+    my (@entries) = @_;
+    my ($want) = @entries > 16 ? scalar (@entries) : 16;
+    my ($depth) = 0;
+    $depth++ while $depth < $DIR_MAX_DEPTH && $BUCKET_ENTRIES << $depth < $want;
+
+    my (@chains);
+    for (;; $depth++) {
+	@chains = map ([], 1...1 << $depth);
+	push (@{$chains[fnv_hash ($_->[0]) & ((1 << $depth) - 1)]}, $_)
+	  foreach @entries;
+	last if $depth == $DIR_MAX_DEPTH
+	  || !grep (@$_ > $BUCKET_ENTRIES, @chains);
+    }
+
+    # Lay out the buckets, with the overflow buckets after the
+    # ones in the table.
+    my (@buckets) = map ([splice (@$_, 0, $BUCKET_ENTRIES)], @chains);
+    my (@next) = (0) x @buckets;
+    for my $b (0...$#chains) {
+	my ($last) = $b;
+	while (@{$chains[$b]}) {
+	    push (@buckets, [splice (@{$chains[$b]}, 0, $BUCKET_ENTRIES)]);
+	    push (@next, 0);
+	    $next[$last] = @buckets;
+	    $last = $#buckets;
+	}
+    }
+
+    my (@table) = (1...1 << $depth);
+    push (@table, (0) x (2**$DIR_MAX_DEPTH - @table));
+    my ($data) = pack ("V4 v" . 2**$DIR_MAX_DEPTH, $DIR_MAGIC, $depth,
+		       scalar (@buckets), scalar (@entries), @table);
+    $data .= "\0" x ($SECTOR_SIZE - length ($data));
+    for my $b (0...$#buckets) {
+	my (@slots) = map (($_->[1], $_->[0], 1), @{$buckets[$b]});
+	push (@slots, (0, '', 0) x ($BUCKET_ENTRIES - @{$buckets[$b]}));
+	$data .= pack ("V3 (V a15 C)$BUCKET_ENTRIES", $depth, $next[$b], 0,
+		       @slots);
+    }
+    return $data;
+}
+
+# fs_make($handle, $file, $start, $sectors, @files)
+#
+# Writes a new file system into the $sectors sectors starting at
+# sector $start of $file, open as $handle, with the host files in
+# @files, each a [HOST_FILE, NAME] pair, in its root directory.
+# The result is what formatting a file system and then extracting
+# the files into it would produce, except that each file is laid
+# out in a single extent right after its inode.  Sectors that end
+# up free are not written.
+sub fs_make {
+    my ($handle, $file, $start, $sectors, @files) = @_;
+
+    # Check the names.
+    my (%seen);
+    foreach my $f (@files) {
+	my ($name) = $f->[1];
+	die "$name: file names may not contain \"/\"\n" if $name =~ m%/%;
+	die "$name: file name is longer than $NAME_MAX characters\n"
+	  if length ($name) > $NAME_MAX;
+	die "$name: not a valid file name\n"
+	  if $name eq '' || $name eq '.' || $name eq '..';
+	die "$name: named twice\n" if $seen{$name}++;
+    }
+
+    # Lay out the file system.  The fixed sectors come first, then
+    # the free map file and the root directory, then each file's
+    # inode followed by its data.
+    my ($free_map_bytes) = div_round_up ($sectors, 32) * 4;
+    my ($journal_slots) = $JOURNAL_SLOTS + fs_free_map_sectors ($sectors);
+    die "file system of $sectors sectors is too big to journal\n"
+      if $journal_slots > $JOURNAL_LOG_MAX;
+    my ($next) = $JOURNAL_SECTOR + 1 + $journal_slots;
+    my ($free_map_start) = $next;
+    $next += div_round_up ($free_map_bytes, $SECTOR_SIZE);
+
+    my (@inodes);
+    foreach my $f (@files) {
+	my ($size) = -s $f->[0];
+	die "$f->[0]: stat: $!\n" if !defined $size;
+	push (@inodes, {FILE => $f->[0], NAME => $f->[1], LENGTH => $size});
+    }
+    my ($dir) = fs_pack_dir (map ([$_->{NAME}, 0], @inodes));
+    my ($dir_sectors) = length ($dir) / $SECTOR_SIZE;
+    my ($dir_start) = $next;
+    $next += $dir_sectors;
+    foreach my $inode (@inodes) {
+	$inode->{SECTOR} = $next;
+	$inode->{START} = $next + 1;
+	$inode->{SECTORS} = div_round_up ($inode->{LENGTH}, $SECTOR_SIZE);
+	$next += 1 + $inode->{SECTORS};
+    }
+    die "file system needs $next sectors but has only $sectors\n"
+      if $next > $sectors;
+    $dir = fs_pack_dir (map ([$_->{NAME}, $_->{SECTOR}], @inodes));
+
+    # Write the free map and the root directory.
+    my ($free_map) = "\0" x $free_map_bytes;
+    vec ($free_map, $_, 1) = 1 foreach 0...$next - 1;
+    $free_map .= "\0" x (round_up ($free_map_bytes, $SECTOR_SIZE)
+			 - $free_map_bytes);
+    fs_write_sector ($handle, $file, $start, $FREE_MAP_SECTOR,
+		     fs_pack_inode (LENGTH => $free_map_bytes,
+				    START => $free_map_start,
+				    SECTORS => length ($free_map) / $SECTOR_SIZE));
+    fs_write_sector ($handle, $file, $start, $free_map_start + $_,
+		     substr ($free_map, $_ * $SECTOR_SIZE, $SECTOR_SIZE))
+      foreach 0...length ($free_map) / $SECTOR_SIZE - 1;
+    fs_write_sector ($handle, $file, $start, $ROOT_DIR_SECTOR,
+		     fs_pack_inode (LENGTH => length ($dir), ISDIR => 1,
+				    START => $dir_start,
+				    SECTORS => $dir_sectors));
+    fs_write_sector ($handle, $file, $start, $dir_start + $_,
+		     substr ($dir, $_ * $SECTOR_SIZE, $SECTOR_SIZE))
+      foreach 0...$dir_sectors - 1;
+
+    # Write an empty journal.
+    fs_write_sector ($handle, $file, $start, $JOURNAL_SECTOR,
+		     pack ("V x[V4] x[V$JOURNAL_LOG_MAX] V",
+			   $JOURNAL_MAGIC, $journal_slots));
+
+    # Write the files.
+    foreach my $inode (@inodes) {
+	fs_write_sector ($handle, $file, $start, $inode->{SECTOR},
+			 fs_pack_inode (%$inode, PARENT => $ROOT_DIR_SECTOR));
+
+	my ($src);
+	open ($src, '<', $inode->{FILE}) or die "$inode->{FILE}: open: $!\n";
+	binmode ($src);
+	sysseek ($handle, ($start + $inode->{START}) * $SECTOR_SIZE, SEEK_SET)
+	  or die "$file: seek: $!\n";
+	copy_file ($src, $inode->{FILE}, $handle, $file, $inode->{LENGTH});
+	write_zeros ($handle, $file,
+		     round_up ($inode->{LENGTH}, $SECTOR_SIZE) - $inode->{LENGTH});
+	close ($src);
+    }
+}
+
+1;